@@ -4,13 +4,17 @@
 
 
 #include <libaio.h>
+#include <liburing.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <iostream>
+#include <stdexcept>
 #include <unistd.h>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include <type_traits>
 #include <functional>
 #include <vector>
@@ -21,11 +25,38 @@
 #include <sys/vfs.h>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <linux/perf_event.h>
+#include <linux/falloc.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/utsname.h>
+#include <linux/fiemap.h>
 #define min min    /* prevent xfs.h from defining min() as a macro */
 #include <xfs/xfs.h>
 
 #include <tabulate/table.hpp>
 
+#ifndef IORING_FEAT_NATIVE_WORKERS
+#define IORING_FEAT_NATIVE_WORKERS (1U << 9) // Linux 5.12, missing from older liburing
+#endif
+
 template <typename Counter, typename Func>
 typename std::result_of<Func()>::type
 with_ctxsw_counting(long (rusage::* field), Counter& counter, Func&& func) {
@@ -78,216 +109,2714 @@ to_string(operation op) {
     std::abort();
 }
 
-struct result {
-    float ctxsw_per_io;
-    std::string verdict;
-    bool pgcache;
-    float ctxsw_background_per_io;
+enum class backend_type {
+    libaio,
+    uring,
+    uring_sqpoll,
+    uring_registered, // registered file and fixed buffer
 };
 
-result
-run_test(unsigned iodepth, size_t bufsize, operation op, bool dsync) {
-    bool pretruncate = op != operation::append;
-    bool prezero = op == operation::read || op == operation::overwrite;
-    bool read = op == operation::read;
-    io_context_t ioctx = {};
-    io_setup(128, &ioctx);
-    auto fname = "fsqual.tmp";
-    auto o_dsync = dsync ? O_DSYNC : 0;
-    int fd = open(fname, O_CREAT|O_EXCL|O_RDWR|O_DIRECT|o_dsync, 0600);
-    fsxattr attr = {};
-    attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
-    attr.fsx_extsize = 32 << 20; // 32MB
-    // Ignore error; may be !xfs, and just a hint anyway
-    ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
-    unlink(fname);
-    if (pretruncate) {
-        ftruncate(fd, off_t(1) << 30);
+std::string
+to_string(backend_type b) {
+    switch (b) {
+    case backend_type::libaio: return "libaio";
+    case backend_type::uring: return "io_uring";
+    case backend_type::uring_sqpoll: return "io_uring+sqpoll";
+    case backend_type::uring_registered: return "io_uring+fixed";
     }
-    auto nr = 10000;
-    auto ctxsw = 0;
-    auto ctxsw_background = 0;
-    auto buf = aligned_alloc(4096, bufsize);
-    auto current_depth = unsigned(0);
-    auto initiated = 0;
-    auto completed = 0;
-    auto iocbs = std::vector<iocb>(iodepth);
-    auto iocbps = std::vector<iocb*>(iodepth);
-    std::iota(iocbps.begin(), iocbps.end(), iocbs.data());
-    auto ioevs = std::vector<io_event>(iodepth);
-    if (prezero) {
-        auto buf = reinterpret_cast<char*>(aligned_alloc(4096, nr*bufsize));
-        std::fill_n(buf, nr*bufsize, char(0));
-        write(fd, buf, nr*bufsize);
-        fdatasync(fd);
-        free(buf);
+    std::abort();
+}
+
+const backend_type all_backends[] = {
+    backend_type::libaio,
+    backend_type::uring,
+    backend_type::uring_sqpoll,
+    backend_type::uring_registered,
+};
+
+enum class completion_mode {
+    poll,    // busy-poll for completions without blocking
+    block,   // block in the kernel until at least one completion arrives
+    eventfd, // block in epoll on an eventfd signalled on completion
+    ring,    // busy-poll the completion ring from userspace, without syscalls
+};
+
+std::string
+to_string(completion_mode m) {
+    switch (m) {
+    case completion_mode::poll: return "poll";
+    case completion_mode::block: return "block";
+    case completion_mode::eventfd: return "eventfd";
+    case completion_mode::ring: return "ring";
     }
-    static thread_local std::random_device s_random_device;
-    std::default_random_engine random_engine(s_random_device());
-    while (completed < nr) {
-        auto i = unsigned(0);
-        while (initiated < nr && current_depth < iodepth) {
+    std::abort();
+}
+
+const completion_mode all_completion_modes[] = {
+    completion_mode::poll,
+    completion_mode::block,
+    completion_mode::eventfd,
+    completion_mode::ring,
+};
+
+struct io_completion {
+    uint64_t tag;
+    long res;
+};
+
+// Submission/completion interface shared by libaio and io_uring. A backend
+// is bound to a single file and a single I/O buffer, so that io_uring can
+// register them up front.
+class io_backend {
+public:
+    virtual ~io_backend() {}
+    // Queue a request; it is not seen by the kernel until submit()
+    virtual void prepare(bool read, void* buf, size_t len, off_t pos, uint64_t tag) = 0;
+    // Hand all prepared requests to the kernel
+    virtual int submit() = 0;
+    // Harvest between min_nr and max_nr completions; min_nr == 0 polls
+    virtual int reap(unsigned min_nr, unsigned max_nr, io_completion* out) = 0;
+    // Like reap(0, ...), but reading the completion ring directly
+    virtual int reap_userspace(unsigned max_nr, io_completion* out) = 0;
+    // Signal eventfd on every completion; returns false if unsupported
+    virtual bool set_eventfd(int eventfd) = 0;
+    // Whether kernel threads working on our behalf (io-wq workers, the
+    // SQPOLL thread) show up in /proc/self/task, so that they can be measured
+    virtual bool io_threads_visible() const {
+        return true;
+    }
+};
+
+// The kernel's completion ring, which io_context_t points to
+struct aio_ring {
+    unsigned id;
+    unsigned nr;
+    unsigned head;
+    unsigned tail;
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;
+    // io_event events[nr] follows
+};
+
+class libaio_backend : public io_backend {
+    static constexpr unsigned aio_ring_magic = 0xa10a10a1;
+    io_context_t _ioctx = {};
+    int _fd;
+    int _eventfd = -1;
+    std::vector<iocb> _iocbs;
+    std::vector<iocb*> _iocbps;
+    std::vector<io_event> _ioevs;
+    unsigned _prepared = 0;
+public:
+    libaio_backend(unsigned queue_depth, int fd)
+            : _fd(fd), _iocbs(queue_depth), _iocbps(queue_depth), _ioevs(queue_depth) {
+        std::iota(_iocbps.begin(), _iocbps.end(), _iocbs.data());
+    }
+    ~libaio_backend() {
+        if (_ioctx) {
+            io_destroy(_ioctx);
+        }
+    }
+    bool setup() {
+        return io_setup(_iocbs.size(), &_ioctx) == 0;
+    }
+    virtual void prepare(bool read, void* buf, size_t len, off_t pos, uint64_t tag) override {
+        auto& cb = _iocbs[_prepared++];
+        if (!read) {
+            io_prep_pwrite(&cb, _fd, buf, len, pos);
+        } else {
+            io_prep_pread(&cb, _fd, buf, len, pos);
+        }
+        if (_eventfd != -1) {
+            io_set_eventfd(&cb, _eventfd);
+        }
+        cb.data = reinterpret_cast<void*>(uintptr_t(tag));
+    }
+    virtual int submit() override {
+        auto n = _prepared;
+        _prepared = 0;
+        return io_submit(_ioctx, n, _iocbps.data());
+    }
+    virtual int reap(unsigned min_nr, unsigned max_nr, io_completion* out) override {
+        auto n = io_getevents(_ioctx, min_nr, std::min<size_t>(max_nr, _ioevs.size()), _ioevs.data(), nullptr);
+        for (auto i = 0; i < n; ++i) {
+            out[i] = io_completion{uint64_t(uintptr_t(_ioevs[i].data)), long(_ioevs[i].res)};
+        }
+        return n;
+    }
+    virtual int reap_userspace(unsigned max_nr, io_completion* out) override {
+        auto ring = reinterpret_cast<aio_ring*>(_ioctx);
+        if (ring->magic != aio_ring_magic || ring->incompat_features) {
+            return reap(0, max_nr, out);
+        }
+        auto events = reinterpret_cast<const io_event*>(ring + 1);
+        auto head = ring->head;
+        auto tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        auto n = 0u;
+        while (head != tail && n < max_nr) {
+            out[n++] = io_completion{uint64_t(uintptr_t(events[head].data)), long(events[head].res)};
+            head = (head + 1) % ring->nr;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+    virtual bool set_eventfd(int eventfd) override {
+        _eventfd = eventfd;
+        return true;
+    }
+};
+
+class uring_backend : public io_backend {
+    io_uring _ring;
+    bool _initialized = false;
+    bool _registered = false;
+    bool _native_workers = false;
+    int _fd;
+    std::vector<io_uring_cqe*> _cqes;
+public:
+    uring_backend(unsigned queue_depth, int fd) : _fd(fd), _cqes(queue_depth) {}
+    ~uring_backend() {
+        if (_initialized) {
+            io_uring_queue_exit(&_ring);
+        }
+    }
+    bool setup(unsigned flags, bool registered, void* buf, size_t bufsize) {
+        io_uring_params params = {};
+        params.flags = flags;
+        params.sq_thread_idle = 1000; // ms
+        if (io_uring_queue_init_params(_cqes.size(), &_ring, &params) < 0) {
+            return false;
+        }
+        _initialized = true;
+        // Before 5.12, io-wq workers and the SQPOLL thread are kthreads
+        // ("io_wqe_worker-*", "io_uring-sq") outside our thread group
+        _native_workers = params.features & IORING_FEAT_NATIVE_WORKERS;
+        if (registered) {
+            iovec iov = { buf, bufsize };
+            if (io_uring_register_files(&_ring, &_fd, 1) < 0
+                    || io_uring_register_buffers(&_ring, &iov, 1) < 0) {
+                return false;
+            }
+            _registered = true;
+        }
+        return true;
+    }
+    virtual void prepare(bool read, void* buf, size_t len, off_t pos, uint64_t tag) override {
+        auto sqe = io_uring_get_sqe(&_ring);
+        if (_registered) {
+            if (!read) {
+                io_uring_prep_write_fixed(sqe, 0, buf, len, pos, 0);
+            } else {
+                io_uring_prep_read_fixed(sqe, 0, buf, len, pos, 0);
+            }
+            sqe->flags |= IOSQE_FIXED_FILE;
+        } else {
             if (!read) {
-                io_prep_pwrite(&iocbs[i++], fd, buf, bufsize, bufsize*initiated++);
+                io_uring_prep_write(sqe, _fd, buf, len, pos);
             } else {
-                io_prep_pread(&iocbs[i++], fd, buf, bufsize, bufsize*initiated++);
+                io_uring_prep_read(sqe, _fd, buf, len, pos);
             }
-            ++current_depth;
         }
-        std::shuffle(iocbs.begin(), iocbs.begin() + i, random_engine);
-        if (i) {
-            with_ctxsw_counting(ctxsw, [&] {
-                io_submit(ioctx, i, iocbps.data());
-            });
+        sqe->user_data = tag;
+    }
+    virtual int submit() override {
+        return io_uring_submit(&_ring);
+    }
+    virtual int reap(unsigned min_nr, unsigned max_nr, io_completion* out) override {
+        if (min_nr) {
+            io_uring_cqe* cqe;
+            io_uring_wait_cqe_nr(&_ring, &cqe, min_nr);
         }
-        auto n = with_involuntary_ctxsw_counting(ctxsw_background, [&] {
-            while (true) {
-                auto nr = io_getevents(ioctx, 0, iodepth, ioevs.data(), nullptr);
-                if (nr > 0) {
-                    return nr;
-                }
-            }
-        });
-        current_depth -= n;
-        completed += n;
+        auto n = io_uring_peek_batch_cqe(&_ring, _cqes.data(), std::min<size_t>(max_nr, _cqes.size()));
+        for (auto i = 0u; i < n; ++i) {
+            out[i] = io_completion{_cqes[i]->user_data, long(_cqes[i]->res)};
+        }
+        io_uring_cq_advance(&_ring, n);
+        return n;
     }
-    auto rate = float(ctxsw) / nr;
-    auto verdict = rate < 0.1 ? "GOOD" : "BAD";
-    auto ptr = mmap(nullptr, nr * 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-    auto incore = std::vector<uint8_t>(nr);
-    mincore(ptr, nr * 4096, incore.data());
-    auto pgcache = std::any_of(incore.begin(), incore.end(), [] (uint8_t m) { return m & 1; });
-    close(fd);
-    io_destroy(ioctx);
-    return result{rate, verdict, pgcache, float(ctxsw_background) / nr};
+    // io_uring_peek_batch_cqe() already reads the ring without a syscall
+    virtual int reap_userspace(unsigned max_nr, io_completion* out) override {
+        return reap(0, max_nr, out);
+    }
+    virtual bool set_eventfd(int eventfd) override {
+        return io_uring_register_eventfd(&_ring, eventfd) == 0;
+    }
+    virtual bool io_threads_visible() const override {
+        return _native_workers;
+    }
+};
+
+// Returns nullptr if the kernel does not support the requested backend
+std::unique_ptr<io_backend>
+make_backend(backend_type type, unsigned queue_depth, int fd, void* buf, size_t bufsize) {
+    switch (type) {
+    case backend_type::libaio: {
+        auto b = std::unique_ptr<libaio_backend>(new libaio_backend(queue_depth, fd));
+        return b->setup() ? std::move(b) : nullptr;
+    }
+    case backend_type::uring:
+    case backend_type::uring_sqpoll:
+    case backend_type::uring_registered: {
+        auto flags = type == backend_type::uring_sqpoll ? IORING_SETUP_SQPOLL : 0;
+        auto registered = type == backend_type::uring_registered;
+        auto b = std::unique_ptr<uring_backend>(new uring_backend(queue_depth, fd));
+        return b->setup(flags, registered, buf, bufsize) ? std::move(b) : nullptr;
+    }
+    }
+    std::abort();
 }
 
-void run_nowait_test(size_t bufsize) {
-    io_context_t ioctx = {};
-    io_setup(128, &ioctx);
+// io_uring always reaps from userspace, so completion_mode::ring is only
+// distinct from completion_mode::poll for libaio.
+bool
+backend_supported(backend_type type, completion_mode completion = completion_mode::poll) {
+    if (completion == completion_mode::ring && type != backend_type::libaio) {
+        return false;
+    }
     auto fname = "fsqual.tmp";
     int fd = open(fname, O_CREAT|O_EXCL|O_RDWR|O_DIRECT, 0600);
-    fsxattr attr = {};
-    attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
-    attr.fsx_extsize = 32 << 20; // 32MB
-    // Ignore error; may be !xfs, and just a hint anyway
-    ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+    if (fd == -1) {
+        return false;
+    }
     unlink(fname);
-    ftruncate(fd, off_t(1) << 30);
+    auto buf = aligned_alloc(4096, 4096);
+    auto io = make_backend(type, 128, fd, buf, 4096);
+    auto ok = bool(io);
+    if (io && completion == completion_mode::eventfd) {
+        auto efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        ok = io->set_eventfd(efd);
+        close(efd);
+    }
+    io.reset();
+    free(buf);
+    close(fd);
+    return ok;
+}
 
-    auto nr = 1000;
-    auto buf = aligned_alloc(4096, bufsize);
-    auto done = 0;
-    auto eagains = 0;
-    iocb cb;
+// Names of this process's threads, by tid
+std::map<long, std::string>
+thread_names() {
+    auto ret = std::map<long, std::string>();
+    auto dir = opendir("/proc/self/task");
+    if (!dir) {
+        return ret;
+    }
+    while (auto de = readdir(dir)) {
+        std::ifstream comm(std::string("/proc/self/task/") + de->d_name + "/comm");
+        std::string name;
+        if (de->d_name[0] != '.' && std::getline(comm, name)) {
+            ret[std::stol(de->d_name)] = name;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
 
-    while (done < nr) {
-        io_prep_pwrite(&cb, fd, buf, bufsize, bufsize * done);
-        iocb* cbp = &cb;
-        cb.aio_rw_flags |= RWF_NOWAIT;
-        io_submit(ioctx, 1, &cbp);
-        while (true) {
-            io_event ev;
-            auto nr = io_getevents(ioctx, 0, 1, &ev, nullptr);
-            if (nr == 0) {
-                continue;
-            }
-            if (ev.res == -EAGAIN) {
-                eagains++;
-                cb.aio_rw_flags &= ~RWF_NOWAIT;
-                io_submit(ioctx, 1, &cbp);
-                continue;
-            }
-            break;
+long
+thread_ctxsw(long tid, bool voluntary_only) {
+    std::ifstream status("/proc/self/task/" + std::to_string(tid) + "/status");
+    std::string line;
+    auto ctxsw = 0L;
+    while (std::getline(status, line)) {
+        std::istringstream is(line);
+        std::string key;
+        long value;
+        if (is >> key >> value
+                && (key == "voluntary_ctxt_switches:" || (!voluntary_only && key == "nonvoluntary_ctxt_switches:"))) {
+            ctxsw += value;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        done++;
     }
-    close(fd);
-    io_destroy(ioctx);
-    tabulate::Table results;
-    results.add_row({"total", "retries", "verdict"});
-    results.add_row({std::to_string(done), std::to_string(eagains), eagains <= 1 ? "GOOD" : "BAD"});
-    std::cout << results << '\n';
+    return ctxsw;
 }
 
-struct dio_info {
-    size_t memory_alignment;
-    size_t disk_alignment;
-};
+// With SQPOLL, requests are issued by a kernel thread ("iou-sqp-<tid of
+// submitter>") rather than in io_uring_submit(), so that is where submission
+// blocks. Only voluntary switches count; the thread is preempted routinely
+// while it polls.
+std::map<long, long>
+sqpoll_ctxsw() {
+    auto ret = std::map<long, long>();
+    auto name = "iou-sqp-" + std::to_string(syscall(SYS_gettid));
+    for (auto& t : thread_names()) {
+        if (t.second == name) {
+            ret[t.first] = thread_ctxsw(t.first, true);
+        }
+    }
+    return ret;
+}
 
-dio_info get_dio_info() {
-    auto fname = "fsqual.tmp";
-    int fd = open(fname, O_CREAT|O_EXCL|O_RDWR|O_DIRECT, 0600);
-    if (fd == -1) {
-        std::cout << "failed to create file\n";
-        return {512, 512};
+// When io_uring cannot issue a request without blocking, it punts it to an
+// io-wq worker thread instead of blocking the submitter. That is the io_uring
+// equivalent of a blocking io_submit, so we count context switches of the
+// calling thread's workers, keyed by tid. Workers are named after the task
+// that issued the request: "iou-wrk-<tid of submitter>", or, with SQPOLL,
+// "iou-wrk-<tid of the iou-sqp-<tid of submitter> thread>".
+std::map<long, long>
+iowq_ctxsw() {
+    auto ret = std::map<long, long>();
+    auto threads = thread_names();
+    auto tid = std::to_string(syscall(SYS_gettid));
+    auto worker_names = std::vector<std::string>{"iou-wrk-" + tid};
+    for (auto& t : threads) {
+        if (t.second == "iou-sqp-" + tid) {
+            worker_names.push_back("iou-wrk-" + std::to_string(t.first));
+        }
     }
-    unlink(fname);
-    struct dioattr da;
-    auto r = ioctl(fd, XFS_IOC_DIOINFO, &da);
-    if (r == -1) {
-        std::cout << "XFS_IOC_DIOINFO failed, guessing alignment\n";
-        return dio_info{512, 512};
+    for (auto& t : threads) {
+        if (std::find(worker_names.begin(), worker_names.end(), t.second) != worker_names.end()) {
+            ret[t.first] = thread_ctxsw(t.first, false);
+        }
     }
-    return dio_info{da.d_mem, da.d_miniosz};
+    return ret;
 }
 
-unsigned get_blocksize() {
-    struct statfs s;
-    statfs(".", &s);
-    return s.f_bsize;
+// Counts context switches of the kernel threads returned by snapshot (tid ->
+// context switches) while func runs
+template <typename Counter, typename Func>
+typename std::result_of<Func()>::type
+with_kernel_thread_ctxsw_counting(std::map<long, long> (*snapshot)(), Counter& counter, Func&& func) {
+    struct count_guard {
+        std::map<long, long> (*snapshot)();
+        Counter& counter;
+        std::map<long, long> before = snapshot();
+        count_guard(std::map<long, long> (*snapshot)(), Counter& counter) : snapshot(snapshot), counter(counter) {}
+        ~count_guard() {
+            for (auto& thread : snapshot()) {
+                auto i = before.find(thread.first);
+                counter += thread.second - (i != before.end() ? i->second : 0);
+            }
+        }
+    };
+    count_guard g(snapshot, counter);
+    return func();
 }
 
-int main(int ac, char** av) {
-    (void)ac;
-    (void)av;
-    auto info = get_dio_info();
-    auto bsize = get_blocksize();
-    std::cout << "memory DMA alignment:    " << info.memory_alignment << "\n";
-    std::cout << "disk DMA alignment:      " << info.disk_alignment << "\n";
-    std::cout << "filesystem block size:   " << bsize << "\n";
+template <typename Counter, typename Func>
+typename std::result_of<Func()>::type
+with_iowq_ctxsw_counting(Counter& counter, Func&& func) {
+    return with_kernel_thread_ctxsw_counting(iowq_ctxsw, counter, std::forward<Func>(func));
+}
 
-    tabulate::Table results;
+template <typename Counter, typename Func>
+typename std::result_of<Func()>::type
+with_sqpoll_ctxsw_counting(Counter& counter, Func&& func) {
+    return with_kernel_thread_ctxsw_counting(sqpoll_ctxsw, counter, std::forward<Func>(func));
+}
 
-    run_nowait_test(bsize);
+// Collects the kernel call paths at which the calling thread blocks, while
+// enabled. Paths are keyed by their frames, innermost first.
+class stack_profiler {
+public:
+    virtual ~stack_profiler() {}
+    virtual void enable() = 0;
+    virtual void disable() = 0;
+    virtual std::map<std::string, unsigned> stacks() = 0;
+};
 
-    results.add_row({"iodepth", "bufsize", "operation", "dsync", "ctxsw/io", "bg ctxtsw/io", "verdict", "pgcache"});
+struct kernel_symbol {
+    uint64_t addr;
+    std::string name;
+    bool operator<(const kernel_symbol& o) const {
+        return addr < o.addr;
+    }
+};
 
-    auto run_test = [&results] (unsigned iodepth, size_t bufsize, operation op, bool dsync) {
-        auto r = ::run_test(iodepth, bufsize, op, dsync);
-        results.add_row({
-            std::to_string(iodepth),
-            std::to_string(bufsize),
-            to_string(op),
-            dsync ? "DSYNC" : "-",
-            std::to_string(r.ctxsw_per_io),
-            std::to_string(r.ctxsw_background_per_io),
-            r.verdict,
-            r.pgcache ? "pgcache" : "-",
-        });
-    };
+const std::vector<kernel_symbol>&
+kernel_symbols() {
+    static const std::vector<kernel_symbol> symbols = [] {
+        auto ret = std::vector<kernel_symbol>();
+        std::ifstream kallsyms("/proc/kallsyms");
+        std::string line;
+        while (std::getline(kallsyms, line)) {
+            std::istringstream is(line);
+            kernel_symbol sym;
+            char type;
+            if (is >> std::hex >> sym.addr >> type >> sym.name && sym.addr) {
+                ret.push_back(std::move(sym));
+            }
+        }
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }();
+    return symbols;
+}
 
-    run_test(1, bsize, operation::append, false);
-    run_test(3, bsize, operation::append, false);
-    run_test(3, bsize, operation::fill, false);
-    run_test(7, bsize, operation::fill, false);
-    run_test(1, info.disk_alignment, operation::fill, false);
-    run_test(1, info.disk_alignment, operation::overwrite, false);
-    run_test(1, info.disk_alignment, operation::overwrite, true);
-    run_test(3, info.disk_alignment, operation::overwrite, true);
-    run_test(3, info.disk_alignment, operation::overwrite, true);
-    run_test(1, bsize, operation::append, false);
-    run_test(3, bsize, operation::append, false);
-    run_test(3, bsize, operation::fill, false);
-    run_test(7, bsize, operation::fill, false);
-    run_test(1, info.disk_alignment, operation::fill, false);
-    run_test(1, info.disk_alignment, operation::overwrite, false);
-    run_test(1, info.disk_alignment, operation::overwrite, true);
-    run_test(3, info.disk_alignment, operation::overwrite, true);
-    run_test(30, info.disk_alignment, operation::read, false);
+std::string
+symbolize(uint64_t addr) {
+    auto& symbols = kernel_symbols();
+    auto i = std::upper_bound(symbols.begin(), symbols.end(), kernel_symbol{addr, {}});
+    if (i == symbols.begin()) {
+        std::ostringstream os;
+        os << std::hex << "0x" << addr;
+        return os.str();
+    }
+    return std::prev(i)->name;
+}
 
-    std::cout << results << "\n";
+// The scheduler's own frames are the same for every path; drop them.
+bool
+is_scheduler_frame(const std::string& name) {
+    for (auto prefix : {"__schedule", "schedule", "preempt_schedule", "perf_", "__perf_"}) {
+        if (name.compare(0, strlen(prefix), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A task preempted on its way out of the kernel or from an interrupt did not
+// block; it just lost its cpu.
+bool
+is_preemption_frame(const std::string& name) {
+    return name.find("exit_to_user_mode") != std::string::npos || name.compare(0, 8, "irqentry") == 0;
+}
+
+// Returns an empty string for preemptions
+std::string
+format_stack(const std::vector<std::string>& frames) {
+    auto ret = std::string();
+    auto shown = 0;
+    for (auto& f : frames) {
+        if (ret.empty() && is_scheduler_frame(f)) {
+            continue;
+        }
+        if (ret.empty() && is_preemption_frame(f)) {
+            return ret;
+        }
+        if (shown++ == 12) {
+            ret += " <- ...";
+            break;
+        }
+        ret += (ret.empty() ? "" : " <- ") + f;
+    }
+    return ret;
+}
+
+// Samples a kernel callchain on every context switch of the calling thread,
+// using the context-switch software perf event.
+class perf_stack_profiler : public stack_profiler {
+    static constexpr size_t data_pages = 64;
+    int _fd = -1;
+    size_t _page_size = sysconf(_SC_PAGESIZE);
+    void* _ring = MAP_FAILED;
+    std::map<std::vector<uint64_t>, unsigned> _chains;
+private:
+    void copy_from_ring(void* to, uint64_t pos, size_t len) {
+        auto data = reinterpret_cast<const char*>(_ring) + _page_size;
+        auto size = data_pages * _page_size;
+        for (size_t i = 0; i < len; ++i) {
+            reinterpret_cast<char*>(to)[i] = data[(pos + i) % size];
+        }
+    }
+    void drain() {
+        auto meta = reinterpret_cast<perf_event_mmap_page*>(_ring);
+        auto head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        auto tail = meta->data_tail;
+        auto record = std::vector<uint64_t>();
+        while (tail < head) {
+            perf_event_header hdr;
+            copy_from_ring(&hdr, tail, sizeof(hdr));
+            if (hdr.type == PERF_RECORD_SAMPLE) {
+                record.resize((hdr.size - sizeof(hdr)) / sizeof(uint64_t));
+                copy_from_ring(record.data(), tail + sizeof(hdr), record.size() * sizeof(uint64_t));
+                auto chain = std::vector<uint64_t>();
+                for (auto i = 1u; i <= record[0] && i < record.size(); ++i) {
+                    if (record[i] < PERF_CONTEXT_MAX) {
+                        chain.push_back(record[i]);
+                    }
+                }
+                ++_chains[chain];
+            }
+            tail += hdr.size;
+        }
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+public:
+    ~perf_stack_profiler() {
+        if (_ring != MAP_FAILED) {
+            munmap(_ring, (1 + data_pages) * _page_size);
+        }
+        if (_fd != -1) {
+            close(_fd);
+        }
+    }
+    bool setup() {
+        // With kptr_restrict, /proc/kallsyms shows every address as 0. The
+        // callchains could not be symbolized, nor preemptions filtered out.
+        if (kernel_symbols().empty()) {
+            return false;
+        }
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+        attr.sample_period = 1;
+        attr.sample_type = PERF_SAMPLE_CALLCHAIN;
+        attr.disabled = 1;
+        attr.exclude_callchain_user = 1;
+        _fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (_fd == -1) {
+            return false;
+        }
+        _ring = mmap(nullptr, (1 + data_pages) * _page_size, PROT_READ|PROT_WRITE, MAP_SHARED, _fd, 0);
+        return _ring != MAP_FAILED;
+    }
+    virtual void enable() override {
+        ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    virtual void disable() override {
+        ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+        drain();
+    }
+    virtual std::map<std::string, unsigned> stacks() override {
+        auto ret = std::map<std::string, unsigned>();
+        for (auto& chain : _chains) {
+            auto frames = std::vector<std::string>();
+            for (auto ip : chain.first) {
+                frames.push_back(symbolize(ip));
+            }
+            auto path = format_stack(frames);
+            if (!path.empty()) {
+                ret[path] += chain.second;
+            }
+        }
+        return ret;
+    }
+};
+
+// Fallback when perf is not available: a helper thread samples
+// /proc/self/task/<tid>/stack while the profiled thread is inside the
+// enabled window. Only blocked tasks show a stack, so every sample is a
+// blocking path, but short blocks are likely to be missed.
+class proc_stack_profiler : public stack_profiler {
+    std::string _path = "/proc/self/task/" + std::to_string(syscall(SYS_gettid)) + "/stack";
+    std::atomic<bool> _enabled = { false };
+    std::atomic<bool> _stop = { false };
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::map<std::string, unsigned> _stacks;
+    std::thread _sampler;
+private:
+    void sample() {
+        std::ifstream f(_path);
+        std::string line;
+        auto frames = std::vector<std::string>();
+        while (std::getline(f, line)) {
+            // "[<0>] rwsem_down_write_slowpath+0x2a1/0x5d0"
+            auto start = line.find("] ");
+            auto end = line.find('+');
+            if (start != std::string::npos) {
+                frames.push_back(line.substr(start + 2, end - start - 2));
+            }
+        }
+        auto path = format_stack(frames);
+        if (path.empty() || !_enabled) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_stacks[path];
+    }
+public:
+    ~proc_stack_profiler() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_one();
+        if (_sampler.joinable()) {
+            _sampler.join();
+        }
+    }
+    bool setup() {
+        // Without permission, the open succeeds but reading fails
+        std::ifstream f(_path);
+        std::string line;
+        if (!std::getline(f, line)) {
+            return false;
+        }
+        _sampler = std::thread([this] {
+            // Don't inherit the profiled thread's pinning: sampling from its
+            // cpu would delay it and show up as its context switches
+            cpu_set_t cpus;
+            if (sched_getaffinity(getpid(), sizeof(cpus), &cpus) == 0) {
+                sched_setaffinity(0, sizeof(cpus), &cpus);
+            }
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [this] { return _enabled || _stop; });
+                    if (_stop) {
+                        return;
+                    }
+                }
+                sample();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+        return true;
+    }
+    virtual void enable() override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _enabled = true;
+        }
+        _wake.notify_one();
+    }
+    virtual void disable() override {
+        _enabled = false;
+    }
+    virtual std::map<std::string, unsigned> stacks() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stacks;
+    }
+};
+
+// Returns nullptr if neither perf (with kernel symbols) nor /proc/<tid>/stack
+// are usable
+std::unique_ptr<stack_profiler>
+make_stack_profiler() {
+    auto perf = std::unique_ptr<perf_stack_profiler>(new perf_stack_profiler());
+    if (perf->setup()) {
+        return perf;
+    }
+    auto proc = std::unique_ptr<proc_stack_profiler>(new proc_stack_profiler());
+    if (proc->setup()) {
+        return proc;
+    }
+    return nullptr;
+}
+
+using clock_type = std::chrono::steady_clock;
+
+uint64_t
+to_ns(clock_type::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+uint64_t
+to_usec(timeval tv) {
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// Log-linear latency histogram, in nanoseconds. Each power of two is split
+// into 8 linear sub-buckets, so a reported percentile is within 12.5% of the
+// true value; recording a sample is a couple of shifts and an increment.
+class latency_histogram {
+    static constexpr unsigned sub_bits = 3;
+    static constexpr unsigned sub_buckets = 1 << sub_bits;
+    std::array<uint64_t, 64 * sub_buckets> _buckets = {};
+    uint64_t _count = 0;
+    uint64_t _max = 0;
+private:
+    static unsigned bucket_of(uint64_t v) {
+        if (v < sub_buckets) {
+            return v;
+        }
+        auto shift = 63 - __builtin_clzll(v) - sub_bits;
+        return ((shift + 1) << sub_bits) + ((v >> shift) & (sub_buckets - 1));
+    }
+    static uint64_t bucket_upper_bound(unsigned b) {
+        if (b < sub_buckets) {
+            return b;
+        }
+        auto shift = (b >> sub_bits) - 1;
+        return ((uint64_t(sub_buckets + (b & (sub_buckets - 1))) + 1) << shift) - 1;
+    }
+public:
+    void add(uint64_t ns) {
+        ++_buckets[bucket_of(ns)];
+        ++_count;
+        _max = std::max(_max, ns);
+    }
+    void merge(const latency_histogram& o) {
+        for (auto i = 0u; i < _buckets.size(); ++i) {
+            _buckets[i] += o._buckets[i];
+        }
+        _count += o._count;
+        _max = std::max(_max, o._max);
+    }
+    uint64_t count() const {
+        return _count;
+    }
+    uint64_t max() const {
+        return _max;
+    }
+    // p in [0, 1]
+    uint64_t percentile(double p) const {
+        auto target = uint64_t(std::ceil(p * _count));
+        auto seen = uint64_t(0);
+        for (auto i = 0u; i < _buckets.size(); ++i) {
+            seen += _buckets[i];
+            if (seen && seen >= target) {
+                return std::min(bucket_upper_bound(i), _max);
+            }
+        }
+        return _max;
+    }
+};
+
+// "p50/p90/p99/p99.9/max", in microseconds
+std::string
+format_percentiles(const latency_histogram& h) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1);
+    for (auto p : {0.5, 0.9, 0.99, 0.999}) {
+        os << h.percentile(p) / 1000.0 << '/';
+    }
+    os << h.max() / 1000.0;
+    return os.str();
+}
+
+// A cell is BAD if io_submit blocks on average, or if the tail latencies
+// exceed the (optional, 0 = unchecked) p99.9 limits.
+struct verdict_limits {
+    float ctxsw_per_io = 0.1;
+    uint64_t submit_p999_ns = 0;
+    uint64_t latency_p999_ns = 0;
+};
+
+struct result {
+    float ctxsw_per_io;
+    std::string verdict;
+    bool pgcache;
+    float ctxsw_background_per_io;
+    float iowq_ctxsw_per_io;
+    float sqpoll_ctxsw_per_io;
+    // False if the io-wq and SQPOLL counts above could not be measured
+    bool io_threads_measured;
+    float iops;
+    float bandwidth; // bytes/sec
+    float usr_usec_per_io;
+    float sys_usec_per_io;
+    unsigned extents;
+    latency_histogram submit_latency;
+    latency_histogram completion_latency;
+    // First failed or short I/O, empty if all succeeded
+    std::string error;
+    // Kernel call path -> number of times the submitting thread blocked there
+    std::map<std::string, unsigned> blocking_stacks;
+};
+
+// Whether submission blocked, in the submitting thread or in the kernel
+// threads issuing on its behalf
+bool
+blocked(const result& r, const verdict_limits& limits) {
+    return r.ctxsw_per_io >= limits.ctxsw_per_io || r.iowq_ctxsw_per_io >= limits.ctxsw_per_io
+            || r.sqpoll_ctxsw_per_io >= limits.ctxsw_per_io;
+}
+
+std::string
+judge(const result& r, const verdict_limits& limits) {
+    auto tail_exceeded = [] (const latency_histogram& h, uint64_t limit) {
+        return limit && h.percentile(0.999) > limit;
+    };
+    if (blocked(r, limits)) {
+        return "BAD";
+    }
+    if (tail_exceeded(r.submit_latency, limits.submit_p999_ns)
+            || tail_exceeded(r.completion_latency, limits.latency_p999_ns)) {
+        return "BAD (tail)";
+    }
+    if (!r.io_threads_measured) {
+        // Punts to io-wq could have gone unseen
+        return "UNKNOWN (io-wq not measurable)";
+    }
+    return "GOOD";
+}
+
+// The io-wq and SQPOLL thread columns; "-" where they don't apply or could
+// not be measured
+std::string
+format_iowq_ctxsw(backend_type backend, const result& r) {
+    return backend != backend_type::libaio && r.io_threads_measured ? std::to_string(r.iowq_ctxsw_per_io) : "-";
+}
+
+std::string
+format_sqpoll_ctxsw(backend_type backend, const result& r) {
+    return backend == backend_type::uring_sqpoll && r.io_threads_measured ? std::to_string(r.sqpoll_ctxsw_per_io) : "-";
+}
+
+// Settings that apply to the whole run rather than to a single cell
+struct test_options {
+    verdict_limits limits;
+    bool collect_stacks = false;
+};
+
+unsigned
+ios_per_test(size_t bufsize) {
+    // Keep the working set within the 1GB pretruncated area
+    return std::min<size_t>(10000, (size_t(1) << 30) / bufsize);
+}
+
+enum class prealloc_method {
+    none,
+    truncate,
+    fallocate,
+    keep_size,            // fallocate(FALLOC_FL_KEEP_SIZE)
+    zero_range,           // fallocate(FALLOC_FL_ZERO_RANGE)
+    zero_range_keep_size, // fallocate(FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE)
+};
+
+std::string
+to_string(prealloc_method m) {
+    switch (m) {
+    case prealloc_method::none: return "-";
+    case prealloc_method::truncate: return "ftruncate";
+    case prealloc_method::fallocate: return "fallocate";
+    case prealloc_method::keep_size: return "fallocate(KEEP_SIZE)";
+    case prealloc_method::zero_range: return "fallocate(ZERO_RANGE)";
+    case prealloc_method::zero_range_keep_size: return "fallocate(ZERO_RANGE|KEEP_SIZE)";
+    }
+    std::abort();
+}
+
+// Opens an unlinked test file, with an extent size hint unless extsize is 0
+int
+open_test_file(const std::string& fname, bool dsync, uint32_t extsize) {
+    auto o_dsync = dsync ? O_DSYNC : 0;
+    int fd = open(fname.c_str(), O_CREAT|O_EXCL|O_RDWR|O_DIRECT|o_dsync, 0600);
+    if (extsize) {
+        fsxattr attr = {};
+        attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
+        attr.fsx_extsize = extsize;
+        // Ignore error; may be !xfs, and just a hint anyway
+        ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+    }
+    unlink(fname.c_str());
+    return fd;
+}
+
+// Returns false if the filesystem does not support the method
+bool
+preallocate(int fd, prealloc_method m, off_t size) {
+    switch (m) {
+    case prealloc_method::none: return true;
+    case prealloc_method::truncate: return ftruncate(fd, size) == 0;
+    case prealloc_method::fallocate: return fallocate(fd, 0, 0, size) == 0;
+    case prealloc_method::keep_size: return fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0;
+    case prealloc_method::zero_range: return fallocate(fd, FALLOC_FL_ZERO_RANGE, 0, size) == 0;
+    case prealloc_method::zero_range_keep_size:
+        return fallocate(fd, FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE, 0, size) == 0;
+    }
+    std::abort();
+}
+
+void
+prezero(int fd, size_t bytes) {
+    auto chunk = std::min<size_t>(bytes, 1 << 20);
+    auto buf = reinterpret_cast<char*>(aligned_alloc(4096, chunk));
+    std::fill_n(buf, chunk, char(0));
+    for (size_t done = 0; done < bytes; done += chunk) {
+        write(fd, buf, std::min(chunk, bytes - done));
+    }
+    fdatasync(fd);
+    free(buf);
+}
+
+// Creates an unlinked test file with a 32MB extent size hint, pretruncated
+// to 1GB unless we are going to append to it, and holding prezero_bytes of
+// written data.
+int
+create_test_file(const std::string& fname, operation op, bool dsync, size_t prezero_bytes) {
+    int fd = open_test_file(fname, dsync, 32 << 20);
+    if (op != operation::append) {
+        preallocate(fd, prealloc_method::truncate, off_t(1) << 30);
+    }
+    if (prezero_bytes) {
+        prezero(fd, prezero_bytes);
+    }
+    return fd;
+}
+
+bool
+needs_prezero(operation op) {
+    return op == operation::read || op == operation::overwrite;
+}
+
+// A stream of nr requests against one file, kept at up to iodepth in
+// flight. Request k goes to block k * stride + index, so several streams can
+// interleave on a shared file, or with random_blocks to a random block below
+// it. With a nonzero rate (requests/sec), request k is not issued before
+// k / rate seconds into the run.
+struct io_stream {
+    int fd;
+    unsigned iodepth;
+    size_t bufsize;
+    unsigned nr;
+    bool read;
+    backend_type backend;
+    unsigned stride;
+    unsigned index;
+    unsigned random_blocks;
+    double rate; // relies on polling for completions
+    completion_mode completion;
+    const std::atomic<bool>* stop; // if set, stop issuing requests once it becomes true
+};
+
+io_stream
+make_stream(int fd, unsigned iodepth, size_t bufsize, operation op, backend_type backend) {
+    io_stream s;
+    s.fd = fd;
+    s.iodepth = iodepth;
+    s.bufsize = bufsize;
+    s.nr = ios_per_test(bufsize);
+    s.read = op == operation::read;
+    s.backend = backend;
+    s.stride = 1;
+    s.index = 0;
+    s.random_blocks = 0;
+    s.rate = 0;
+    s.completion = completion_mode::poll;
+    s.stop = nullptr;
+    return s;
+}
+
+result
+run_io(const io_stream& s, const test_options& opts) {
+    auto iodepth = s.iodepth;
+    auto bufsize = s.bufsize;
+    auto nr = int(s.nr);
+    auto ctxsw = 0;
+    auto ctxsw_background = 0;
+    auto ctxsw_iowq = 0;
+    auto ctxsw_sqpoll = 0;
+    auto buf = aligned_alloc(4096, bufsize);
+    auto current_depth = unsigned(0);
+    auto initiated = 0;
+    auto completed = 0;
+    auto failed = 0;
+    auto submit_failed = false;
+    auto ids = std::vector<unsigned>(iodepth);
+    auto submit_time = std::vector<clock_type::time_point>(nr);
+    auto r = result();
+    auto completions = std::vector<io_completion>(iodepth);
+    auto io = make_backend(s.backend, std::max(iodepth, 128u), s.fd, buf, bufsize);
+    if (!io) {
+        // e.g. many threads' AIO contexts exceeding fs.aio-max-nr
+        free(buf);
+        r.error = "cannot set up " + to_string(s.backend) + " context";
+        r.verdict = "ERROR (" + r.error + ")";
+        return r;
+    }
+    auto profiler = opts.collect_stacks ? make_stack_profiler() : nullptr;
+    static thread_local std::random_device s_random_device;
+    std::default_random_engine random_engine(s_random_device());
+    std::uniform_int_distribution<unsigned> random_block(0, std::max(s.random_blocks, 1u) - 1);
+    auto efd = -1;
+    auto epfd = -1;
+    if (s.completion == completion_mode::eventfd) {
+        efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev);
+        io->set_eventfd(efd);
+    }
+    auto harvest = [&] {
+        switch (s.completion) {
+        case completion_mode::poll:
+            return io->reap(0, iodepth, completions.data());
+        case completion_mode::block:
+            return io->reap(1, iodepth, completions.data());
+        case completion_mode::eventfd: {
+            epoll_event ev;
+            epoll_wait(epfd, &ev, 1, -1);
+            uint64_t count;
+            read(efd, &count, sizeof(count));
+            return io->reap(0, iodepth, completions.data());
+        }
+        case completion_mode::ring:
+            return io->reap_userspace(iodepth, completions.data());
+        }
+        std::abort();
+    };
+    rusage usage_start;
+    getrusage(RUSAGE_THREAD, &usage_start);
+    auto run_start = clock_type::now();
+    auto due = [&] {
+        return !s.rate || clock_type::now() - run_start >= std::chrono::duration<double>(initiated / s.rate);
+    };
+    auto issue_and_reap = [&] {
+        auto stopped = [&] {
+            return submit_failed || (s.stop && s.stop->load(std::memory_order_relaxed));
+        };
+        while (completed < nr && !(completed == initiated && stopped())) {
+            auto i = unsigned(0);
+            while (initiated < nr && current_depth < iodepth && !stopped() && due()) {
+                ids[i++] = initiated++;
+                ++current_depth;
+            }
+            std::shuffle(ids.begin(), ids.begin() + i, random_engine);
+            for (auto j = 0u; j < i; ++j) {
+                auto block = s.random_blocks ? random_block(random_engine) : off_t(ids[j]) * s.stride + s.index;
+                io->prepare(s.read, buf, bufsize, off_t(bufsize) * block, ids[j]);
+            }
+            if (i) {
+                // Only the submission itself is timed and counted; profiling
+                // overhead stays outside
+                auto start = clock_type::time_point();
+                auto finish = clock_type::time_point();
+                if (profiler) {
+                    profiler->enable();
+                }
+                auto submitted = with_ctxsw_counting(ctxsw, [&] {
+                    start = clock_type::now();
+                    auto ret = io->submit();
+                    finish = clock_type::now();
+                    return ret;
+                });
+                r.submit_latency.add(to_ns(finish - start));
+                if (profiler) {
+                    profiler->disable();
+                }
+                for (auto j = 0u; j < i; ++j) {
+                    submit_time[ids[j]] = start;
+                }
+                if (submitted != int(i)) {
+                    // Requests the kernel did not take will never complete; drain
+                    // the ones it did and give up
+                    auto rejected = i - std::max(submitted, 0);
+                    current_depth -= rejected;
+                    initiated -= rejected;
+                    submit_failed = true;
+                    if (r.error.empty()) {
+                        r.error = submitted < 0 ? std::string("submit: ") + strerror(-submitted)
+                                : "submit took " + std::to_string(submitted) + " of " + std::to_string(i) + " requests";
+                    }
+                }
+            }
+            if (!current_depth) {
+                continue;
+            }
+            auto n = with_involuntary_ctxsw_counting(ctxsw_background, [&] {
+                while (true) {
+                    auto reaped = harvest();
+                    // A rate-limited stream must not miss its next issue time
+                    if (reaped > 0 || (s.rate && initiated < nr && due())) {
+                        return reaped;
+                    }
+                }
+            });
+            auto now = clock_type::now();
+            for (auto j = 0; j < n; ++j) {
+                auto res = completions[j].res;
+                if (res != long(bufsize)) {
+                    if (!failed++) {
+                        r.error = res < 0 ? strerror(-res) : "short transfer of " + std::to_string(res) + " bytes";
+                    }
+                    continue;
+                }
+                r.completion_latency.add(to_ns(now - submit_time[completions[j].tag]));
+            }
+            current_depth -= n;
+            completed += n;
+        }
+    };
+    with_sqpoll_ctxsw_counting(ctxsw_sqpoll, [&] {
+        with_iowq_ctxsw_counting(ctxsw_iowq, issue_and_reap);
+    });
+    auto elapsed = std::chrono::duration<double>(clock_type::now() - run_start).count();
+    auto io_threads_measured = io->io_threads_visible();
+    rusage usage_end;
+    getrusage(RUSAGE_THREAD, &usage_end);
+    io.reset();
+    free(buf);
+    if (efd != -1) {
+        close(epfd);
+        close(efd);
+    }
+    if (profiler) {
+        r.blocking_stacks = profiler->stacks();
+    }
+    r.iops = (completed - failed) / elapsed;
+    r.bandwidth = (completed - failed) * bufsize / elapsed;
+    nr = std::max(completed, 1); // fewer than requested if stopped or failed
+    r.usr_usec_per_io = float(to_usec(usage_end.ru_utime) - to_usec(usage_start.ru_utime)) / nr;
+    r.sys_usec_per_io = float(to_usec(usage_end.ru_stime) - to_usec(usage_start.ru_stime)) / nr;
+    r.ctxsw_per_io = float(ctxsw) / nr;
+    r.ctxsw_background_per_io = float(ctxsw_background) / nr;
+    r.iowq_ctxsw_per_io = float(ctxsw_iowq) / nr;
+    r.io_threads_measured = io_threads_measured;
+    r.sqpoll_ctxsw_per_io = float(ctxsw_sqpoll) / nr;
+    // Numbers from failed I/O are meaningless, whatever they say
+    if (r.error.empty()) {
+        r.verdict = judge(r, opts.limits);
+    } else {
+        r.verdict = "ERROR (" + (failed ? std::to_string(failed) + " failed: " : std::string()) + r.error + ")";
+    }
+    return r;
+}
+
+// Number of extents backing the file, or 0 if FIEMAP is not supported
+unsigned
+count_extents(int fd) {
+    fiemap fm = {};
+    fm.fm_length = FIEMAP_MAX_OFFSET;
+    fm.fm_flags = FIEMAP_FLAG_SYNC;
+    if (ioctl(fd, FS_IOC_FIEMAP, &fm) == -1) {
+        return 0;
+    }
+    return fm.fm_mapped_extents;
+}
+
+result
+run_test(unsigned iodepth, size_t bufsize, operation op, bool dsync, backend_type backend,
+        completion_mode completion, const test_options& opts) {
+    auto nr = ios_per_test(bufsize);
+    int fd = create_test_file("fsqual.tmp", op, dsync, needs_prezero(op) ? nr * bufsize : 0);
+    auto s = make_stream(fd, iodepth, bufsize, op, backend);
+    s.completion = completion;
+    auto r = run_io(s, opts);
+    auto ptr = mmap(nullptr, nr * 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    auto incore = std::vector<uint8_t>(nr);
+    mincore(ptr, nr * 4096, incore.data());
+    r.pgcache = std::any_of(incore.begin(), incore.end(), [] (uint8_t m) { return m & 1; });
+    munmap(ptr, nr * 4096);
+    r.extents = count_extents(fd);
+    close(fd);
+    return r;
+}
+
+void run_nowait_test(size_t bufsize) {
+    io_context_t ioctx = {};
+    io_setup(128, &ioctx);
+    auto fname = "fsqual.tmp";
+    int fd = open(fname, O_CREAT|O_EXCL|O_RDWR|O_DIRECT, 0600);
+    fsxattr attr = {};
+    attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
+    attr.fsx_extsize = 32 << 20; // 32MB
+    // Ignore error; may be !xfs, and just a hint anyway
+    ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+    unlink(fname);
+    ftruncate(fd, off_t(1) << 30);
+
+    auto nr = 1000;
+    auto buf = aligned_alloc(4096, bufsize);
+    auto done = 0;
+    auto eagains = 0;
+    iocb cb;
+
+    while (done < nr) {
+        io_prep_pwrite(&cb, fd, buf, bufsize, bufsize * done);
+        iocb* cbp = &cb;
+        cb.aio_rw_flags |= RWF_NOWAIT;
+        io_submit(ioctx, 1, &cbp);
+        while (true) {
+            io_event ev;
+            auto nr = io_getevents(ioctx, 0, 1, &ev, nullptr);
+            if (nr == 0) {
+                continue;
+            }
+            if (ev.res == -EAGAIN) {
+                eagains++;
+                cb.aio_rw_flags &= ~RWF_NOWAIT;
+                io_submit(ioctx, 1, &cbp);
+                continue;
+            }
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        done++;
+    }
+    close(fd);
+    io_destroy(ioctx);
+    tabulate::Table results;
+    results.add_row({"total", "retries", "verdict"});
+    results.add_row({std::to_string(done), std::to_string(eagains), eagains <= 1 ? "GOOD" : "BAD"});
+    std::cout << results << '\n';
+}
+
+struct dio_info {
+    size_t memory_alignment;
+    size_t disk_alignment;
+};
+
+dio_info get_dio_info() {
+    auto fname = "fsqual.tmp";
+    int fd = open(fname, O_CREAT|O_EXCL|O_RDWR|O_DIRECT, 0600);
+    if (fd == -1) {
+        std::cout << "failed to create file\n";
+        return {512, 512};
+    }
+    unlink(fname);
+    struct dioattr da;
+    auto r = ioctl(fd, XFS_IOC_DIOINFO, &da);
+    if (r == -1) {
+        std::cout << "XFS_IOC_DIOINFO failed, guessing alignment\n";
+        return dio_info{512, 512};
+    }
+    return dio_info{da.d_mem, da.d_miniosz};
+}
+
+unsigned get_blocksize() {
+    struct statfs s;
+    statfs(".", &s);
+    return s.f_bsize;
+}
+
+// Walk iodepth and request size for each operation, looking for the deepest
+// queue that still submits without blocking, and for the knee of the
+// throughput curve (the shallowest depth reaching 90% of peak bandwidth).
+void run_sweep(size_t min_bufsize, const std::vector<backend_type>& backends, const test_options& opts) {
+    tabulate::Table details;
+    tabulate::Table summary;
+    details.add_row({"operation", "bufsize", "backend", "iodepth", "ctxsw/io", "io-wq ctxsw/io", "IOPS", "MB/s",
+            "latency usec p50/p90/p99/p99.9/max", "verdict"});
+    summary.add_row({"operation", "bufsize", "backend", "max non-blocking iodepth", "knee iodepth",
+            "peak IOPS", "peak MB/s", "failed iodepths"});
+    for (auto op : {operation::append, operation::fill, operation::overwrite, operation::read}) {
+        for (auto bufsize = min_bufsize; bufsize <= (1 << 20); bufsize *= 2) {
+            for (auto backend : backends) {
+                auto samples = std::vector<std::pair<unsigned, result>>();
+                auto max_nonblocking = 0u;
+                auto any_blocked = false;
+                auto measured = true;
+                auto failed = std::string();
+                // Stop when there are too few I/Os to keep the queue full for a meaningful time
+                for (auto iodepth = 1u; iodepth <= 1024 && iodepth * 4 <= ios_per_test(bufsize); iodepth *= 2) {
+                    auto r = run_test(iodepth, bufsize, op, false, backend, completion_mode::poll, opts);
+                    // Tail latency limits and failed I/O say nothing about blocking
+                    if (!r.error.empty()) {
+                        failed += (failed.empty() ? "" : ",") + std::to_string(iodepth);
+                    } else {
+                        any_blocked |= blocked(r, opts.limits);
+                        measured &= r.io_threads_measured;
+                        if (!any_blocked) {
+                            max_nonblocking = iodepth;
+                        }
+                    }
+                    details.add_row({
+                        to_string(op),
+                        std::to_string(bufsize),
+                        to_string(backend),
+                        std::to_string(iodepth),
+                        std::to_string(r.ctxsw_per_io),
+                        format_iowq_ctxsw(backend, r),
+                        std::to_string(unsigned(r.iops)),
+                        std::to_string(unsigned(r.bandwidth / 1e6)),
+                        format_percentiles(r.completion_latency),
+                        r.verdict,
+                    });
+                    samples.emplace_back(iodepth, std::move(r));
+                }
+                auto peak = std::max_element(samples.begin(), samples.end(), [] (const std::pair<unsigned, result>& a, const std::pair<unsigned, result>& b) {
+                    return a.second.bandwidth < b.second.bandwidth;
+                });
+                auto knee = std::find_if(samples.begin(), samples.end(), [&] (const std::pair<unsigned, result>& s) {
+                    return s.second.bandwidth >= 0.9 * peak->second.bandwidth;
+                });
+                summary.add_row({
+                    to_string(op),
+                    std::to_string(bufsize),
+                    to_string(backend),
+                    !measured ? "unknown" : max_nonblocking ? std::to_string(max_nonblocking) : "none",
+                    std::to_string(knee->first),
+                    std::to_string(unsigned(peak->second.iops)),
+                    std::to_string(unsigned(peak->second.bandwidth / 1e6)),
+                    failed.empty() ? "-" : failed,
+                });
+            }
+        }
+    }
+    std::cout << details << "\n\n" << summary << "\n";
+}
+
+// Compares ways of preparing a file for append and fill workloads: the
+// preallocation call's own cost, and how the subsequent writes behave.
+void run_prealloc_matrix(size_t bufsize, const std::vector<backend_type>& backends, const test_options& opts) {
+    struct strategy {
+        operation op;
+        prealloc_method method;
+    };
+    const strategy strategies[] = {
+        { operation::append, prealloc_method::none },
+        { operation::append, prealloc_method::keep_size },
+        { operation::append, prealloc_method::zero_range_keep_size },
+        { operation::fill, prealloc_method::truncate },
+        { operation::fill, prealloc_method::fallocate },
+        { operation::fill, prealloc_method::zero_range },
+    };
+    const uint32_t extsizes[] = { 0, 1 << 20, 32 << 20 };
+    auto iodepth = 3u;
+    auto size = off_t(ios_per_test(bufsize)) * bufsize;
+    tabulate::Table results;
+    results.add_row({"operation", "prealloc", "extsize hint", "backend", "prealloc usec", "prealloc ctxsw",
+            "ctxsw/io", "io-wq ctxsw/io", "IOPS", "MB/s", "latency usec p50/p90/p99/p99.9/max", "verdict"});
+    for (auto& st : strategies) {
+        for (auto extsize : extsizes) {
+            for (auto backend : backends) {
+                auto fd = open_test_file("fsqual.tmp", false, extsize);
+                auto prealloc_ctxsw = 0L;
+                auto start = clock_type::now();
+                auto ok = with_ctxsw_counting(prealloc_ctxsw, [&] {
+                    return preallocate(fd, st.method, size);
+                });
+                auto prealloc_ns = to_ns(clock_type::now() - start);
+                auto row = tabulate::Table::Row_t{
+                    to_string(st.op),
+                    to_string(st.method),
+                    extsize ? std::to_string(extsize >> 20) + "MB" : "-",
+                    to_string(backend),
+                };
+                if (!ok) {
+                    close(fd);
+                    row.insert(row.end(), {"-", "-", "-", "-", "-", "-", "-", "unsupported"});
+                    results.add_row(row);
+                    continue;
+                }
+                auto r = run_io(make_stream(fd, iodepth, bufsize, st.op, backend), opts);
+                close(fd);
+                row.insert(row.end(), {
+                    std::to_string(prealloc_ns / 1000),
+                    std::to_string(prealloc_ctxsw),
+                    std::to_string(r.ctxsw_per_io),
+                    format_iowq_ctxsw(backend, r),
+                    std::to_string(unsigned(r.iops)),
+                    std::to_string(unsigned(r.bandwidth / 1e6)),
+                    format_percentiles(r.completion_latency),
+                    r.verdict,
+                });
+                results.add_row(row);
+            }
+        }
+    }
+    std::cout << results << "\n";
+}
+
+// Releases a set of threads together, once all have finished their setup
+class start_barrier {
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    unsigned _waiting;
+public:
+    explicit start_barrier(unsigned n) : _waiting(n) {}
+    void arrive_and_wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (--_waiting == 0) {
+            _cv.notify_all();
+        } else {
+            _cv.wait(lock, [this] { return _waiting == 0; });
+        }
+    }
+};
+
+// Runs func on a new thread and returns its result. Jobs that pin themselves
+// run this way so that the pinning does not leak into the main thread.
+template <typename Func>
+typename std::result_of<Func()>::type
+run_on_thread(Func func) {
+    typename std::result_of<Func()>::type ret;
+    std::thread([&] { ret = func(); }).join();
+    return ret;
+}
+
+std::vector<unsigned>
+allowed_cpus() {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    sched_getaffinity(0, sizeof(cs), &cs);
+    auto ret = std::vector<unsigned>();
+    for (auto cpu = 0u; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &cs)) {
+            ret.push_back(cpu);
+        }
+    }
+    return ret;
+}
+
+void pin_to_cpu(unsigned cpu) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    sched_setaffinity(0, sizeof(cs), &cs);
+}
+
+// Runs one stream per cpu, each from a thread pinned to that cpu and with its
+// own I/O context, all starting together. Each thread writes its own file,
+// or with shared, all threads interleave their requests on a single file.
+std::vector<result>
+run_shards(const std::vector<unsigned>& cpus, bool shared, unsigned iodepth, size_t bufsize, operation op,
+        backend_type backend, const test_options& opts) {
+    auto nthreads = unsigned(cpus.size());
+    // A shared file gives each thread its share of the 1GB test area
+    auto nr = ios_per_test(shared ? bufsize * nthreads : bufsize);
+    auto prezero_bytes = needs_prezero(op) ? nr * bufsize * (shared ? nthreads : 1) : 0;
+    auto shared_fd = shared ? create_test_file("fsqual.tmp", op, false, prezero_bytes) : -1;
+    auto results = std::vector<result>(nthreads);
+    start_barrier barrier(nthreads);
+    auto threads = std::vector<std::thread>();
+    for (auto t = 0u; t < nthreads; ++t) {
+        threads.emplace_back([&, t] {
+            pin_to_cpu(cpus[t]);
+            auto fd = shared ? shared_fd
+                    : create_test_file("fsqual-" + std::to_string(t) + ".tmp", op, false, prezero_bytes);
+            auto s = make_stream(fd, iodepth, bufsize, op, backend);
+            s.nr = nr;
+            if (shared) {
+                s.stride = nthreads;
+                s.index = t;
+            }
+            barrier.arrive_and_wait();
+            results[t] = run_io(s, opts);
+            if (!shared) {
+                close(fd);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (shared) {
+        close(shared_fd);
+    }
+    return results;
+}
+
+// Shard-per-core scaling: run 1, 2, 4, ... up to max_threads pinned threads
+// concurrently, to expose inode, allocation group and journal contention.
+void run_scaling(unsigned max_threads, bool shared, size_t bufsize, const std::vector<backend_type>& backends,
+        const test_options& opts) {
+    auto cpus = allowed_cpus();
+    if (max_threads && max_threads < cpus.size()) {
+        cpus.resize(max_threads);
+    }
+    auto counts = std::vector<unsigned>();
+    for (auto n = 1u; n < cpus.size(); n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(cpus.size());
+    auto iodepth = 3u;
+    tabulate::Table scaling;
+    tabulate::Table per_thread;
+    scaling.add_row({"operation", "backend", "threads", "file", "ctxsw/io", "io-wq ctxsw/io", "IOPS", "MB/s",
+            "latency usec p50/p90/p99/p99.9/max", "verdict"});
+    per_thread.add_row({"operation", "backend", "thread", "cpu", "ctxsw/io", "io-wq ctxsw/io", "IOPS", "MB/s",
+            "latency usec p50/p90/p99/p99.9/max", "verdict"});
+    for (auto op : {operation::append, operation::fill, operation::overwrite, operation::read}) {
+        for (auto backend : backends) {
+            for (auto n : counts) {
+                auto subset = std::vector<unsigned>(cpus.begin(), cpus.begin() + n);
+                auto rs = run_shards(subset, shared, iodepth, bufsize, op, backend, opts);
+                auto total = result();
+                total.io_threads_measured = true;
+                auto bad = 0u;
+                auto error = std::string();
+                for (auto& r : rs) {
+                    total.ctxsw_per_io += r.ctxsw_per_io / n;
+                    total.iowq_ctxsw_per_io += r.iowq_ctxsw_per_io / n;
+                    total.iops += r.iops;
+                    total.bandwidth += r.bandwidth;
+                    total.completion_latency.merge(r.completion_latency);
+                    total.io_threads_measured &= r.io_threads_measured;
+                    bad += r.verdict.compare(0, 3, "BAD") == 0;
+                    if (error.empty()) {
+                        error = r.error;
+                    }
+                }
+                scaling.add_row({
+                    to_string(op),
+                    to_string(backend),
+                    std::to_string(n),
+                    shared ? "shared" : "per-thread",
+                    std::to_string(total.ctxsw_per_io),
+                    format_iowq_ctxsw(backend, total),
+                    std::to_string(unsigned(total.iops)),
+                    std::to_string(unsigned(total.bandwidth / 1e6)),
+                    format_percentiles(total.completion_latency),
+                    !error.empty() ? "ERROR (" + error + ")"
+                        : bad ? "BAD (" + std::to_string(bad) + "/" + std::to_string(n) + " threads)"
+                        : !total.io_threads_measured ? "UNKNOWN (io-wq not measurable)" : "GOOD",
+                });
+                if (n != cpus.size()) {
+                    continue;
+                }
+                for (auto t = 0u; t < n; ++t) {
+                    auto& r = rs[t];
+                    per_thread.add_row({
+                        to_string(op),
+                        to_string(backend),
+                        std::to_string(t),
+                        std::to_string(cpus[t]),
+                        std::to_string(r.ctxsw_per_io),
+                        format_iowq_ctxsw(backend, r),
+                        std::to_string(unsigned(r.iops)),
+                        std::to_string(unsigned(r.bandwidth / 1e6)),
+                        format_percentiles(r.completion_latency),
+                        r.verdict,
+                    });
+                }
+            }
+        }
+    }
+    std::cout << scaling << "\n\n" << per_thread << "\n";
+}
+
+// Runs a rate-limited O_DSYNC append stream (a commitlog) and a rate-limited
+// random read stream against separate files, each from its own thread and I/O
+// context, first each in isolation and then both at once, to quantify how
+// journal flushes and reads interfere with each other.
+void run_interference(size_t bufsize, double write_rate, double read_rate, unsigned duration,
+        const std::vector<backend_type>& backends, const test_options& opts) {
+    auto cpus = allowed_cpus();
+    auto read_blocks = ios_per_test(bufsize);
+    auto run_writer = [&] (backend_type backend, start_barrier& barrier) {
+        pin_to_cpu(cpus[0]);
+        auto fd = create_test_file("fsqual-commitlog.tmp", operation::append, true, 0);
+        auto s = make_stream(fd, 4, bufsize, operation::append, backend);
+        s.nr = std::max(1u, unsigned(write_rate * duration));
+        s.rate = write_rate;
+        barrier.arrive_and_wait();
+        auto r = run_io(s, opts);
+        close(fd);
+        return r;
+    };
+    auto run_reader = [&] (backend_type backend, start_barrier& barrier) {
+        pin_to_cpu(cpus[1 % cpus.size()]);
+        auto fd = create_test_file("fsqual-data.tmp", operation::read, false, read_blocks * bufsize);
+        auto s = make_stream(fd, 16, bufsize, operation::read, backend);
+        s.nr = std::max(1u, unsigned(read_rate * duration));
+        s.rate = read_rate;
+        s.random_blocks = read_blocks;
+        barrier.arrive_and_wait();
+        auto r = run_io(s, opts);
+        close(fd);
+        return r;
+    };
+    tabulate::Table results;
+    results.add_row({"stream", "backend", "run", "target IOPS", "IOPS", "ctxsw/io",
+            "latency usec p50/p90/p99/p99.9/max", "p99.9 vs isolated", "verdict"});
+    auto add_rows = [&] (const std::string& stream, backend_type backend, double rate,
+            const result& isolated, const result& concurrent) {
+        auto ratio = double(concurrent.completion_latency.percentile(0.999))
+                / std::max<uint64_t>(isolated.completion_latency.percentile(0.999), 1);
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(2) << "x" << ratio;
+        for (auto concurrent_run : {false, true}) {
+            auto& r = concurrent_run ? concurrent : isolated;
+            results.add_row({
+                stream,
+                to_string(backend),
+                concurrent_run ? "concurrent" : "isolated",
+                std::to_string(unsigned(rate)),
+                std::to_string(unsigned(r.iops)),
+                std::to_string(r.ctxsw_per_io),
+                format_percentiles(r.completion_latency),
+                concurrent_run ? os.str() : "-",
+                r.verdict,
+            });
+        }
+    };
+    for (auto backend : backends) {
+        start_barrier writer_alone(1);
+        auto writer_isolated = run_on_thread([&] { return run_writer(backend, writer_alone); });
+        start_barrier reader_alone(1);
+        auto reader_isolated = run_on_thread([&] { return run_reader(backend, reader_alone); });
+        start_barrier both(2);
+        auto writer_concurrent = result();
+        auto writer = std::thread([&] { writer_concurrent = run_writer(backend, both); });
+        auto reader_concurrent = run_on_thread([&] { return run_reader(backend, both); });
+        writer.join();
+        add_rows("append+DSYNC", backend, write_rate, writer_isolated, writer_concurrent);
+        add_rows("random read", backend, read_rate, reader_isolated, reader_concurrent);
+    }
+    std::cout << results << "\n";
+}
+
+using test_variant = std::pair<backend_type, completion_mode>;
+
+struct cell_result {
+    unsigned iodepth;
+    size_t bufsize;
+    operation op;
+    bool dsync;
+    backend_type backend;
+    completion_mode completion;
+    result r;
+};
+
+// The qualification matrix, run under each backend and completion mode
+std::vector<cell_result>
+run_matrix(const dio_info& info, unsigned bsize, const std::vector<test_variant>& variants, const test_options& opts) {
+    auto cells = std::vector<cell_result>();
+    auto run_test = [&] (unsigned iodepth, size_t bufsize, operation op, bool dsync) {
+        for (auto& v : variants) {
+            auto r = ::run_test(iodepth, bufsize, op, dsync, v.first, v.second, opts);
+            cells.push_back(cell_result{iodepth, bufsize, op, dsync, v.first, v.second, std::move(r)});
+        }
+    };
+
+    run_test(1, bsize, operation::append, false);
+    run_test(3, bsize, operation::append, false);
+    run_test(3, bsize, operation::fill, false);
+    run_test(7, bsize, operation::fill, false);
+    run_test(1, info.disk_alignment, operation::fill, false);
+    run_test(1, info.disk_alignment, operation::overwrite, false);
+    run_test(1, info.disk_alignment, operation::overwrite, true);
+    run_test(3, info.disk_alignment, operation::overwrite, true);
+    run_test(3, info.disk_alignment, operation::overwrite, true);
+    run_test(1, bsize, operation::append, false);
+    run_test(3, bsize, operation::append, false);
+    run_test(3, bsize, operation::fill, false);
+    run_test(7, bsize, operation::fill, false);
+    run_test(1, info.disk_alignment, operation::fill, false);
+    run_test(1, info.disk_alignment, operation::overwrite, false);
+    run_test(1, info.disk_alignment, operation::overwrite, true);
+    run_test(3, info.disk_alignment, operation::overwrite, true);
+    run_test(30, info.disk_alignment, operation::read, false);
+
+    return cells;
+}
+
+// The columns identifying a cell
+tabulate::Table::Row_t
+cell_columns(const cell_result& c) {
+    return {
+        std::to_string(c.iodepth),
+        std::to_string(c.bufsize),
+        to_string(c.op),
+        c.dsync ? "DSYNC" : "-",
+        to_string(c.backend),
+        to_string(c.completion),
+    };
+}
+
+const tabulate::Table::Row_t cell_headers = {"iodepth", "bufsize", "operation", "dsync", "backend", "completion"};
+
+tabulate::Table::Row_t
+with_headers(std::initializer_list<tabulate::Table::Row_t::value_type> columns) {
+    auto row = cell_headers;
+    row.insert(row.end(), columns);
+    return row;
+}
+
+void print_matrix(const std::vector<cell_result>& cells, const test_options& opts) {
+    tabulate::Table results;
+    tabulate::Table stacks;
+    results.add_row(with_headers({"ctxsw/io", "bg ctxtsw/io", "io-wq ctxsw/io", "sqpoll ctxsw/io", "IOPS", "MB/s", "usr usec/io",
+            "sys usec/io", "submit usec p50/p90/p99/p99.9/max", "latency usec p50/p90/p99/p99.9/max", "extents",
+            "verdict", "pgcache"}));
+    stacks.add_row(with_headers({"blocked", "kernel call path"}));
+    for (auto& c : cells) {
+        auto& r = c.r;
+        auto row = cell_columns(c);
+        row.insert(row.end(), {
+            std::to_string(r.ctxsw_per_io),
+            std::to_string(r.ctxsw_background_per_io),
+            format_iowq_ctxsw(c.backend, r),
+            format_sqpoll_ctxsw(c.backend, r),
+            std::to_string(unsigned(r.iops)),
+            std::to_string(unsigned(r.bandwidth / 1e6)),
+            std::to_string(r.usr_usec_per_io),
+            std::to_string(r.sys_usec_per_io),
+            format_percentiles(r.submit_latency),
+            format_percentiles(r.completion_latency),
+            std::to_string(r.extents),
+            r.verdict,
+            r.pgcache ? "pgcache" : "-",
+        });
+        results.add_row(row);
+        auto top = std::vector<std::pair<std::string, unsigned>>(r.blocking_stacks.begin(), r.blocking_stacks.end());
+        std::sort(top.begin(), top.end(), [] (const std::pair<std::string, unsigned>& a, const std::pair<std::string, unsigned>& b) {
+            return a.second > b.second;
+        });
+        top.resize(std::min<size_t>(top.size(), 5));
+        for (auto& path : top) {
+            auto row = cell_columns(c);
+            row.insert(row.end(), {std::to_string(path.second), path.first});
+            stacks.add_row(row);
+        }
+    }
+    std::cout << results << "\n";
+    if (opts.collect_stacks) {
+        std::cout << "\n" << stacks << "\n";
+    }
+}
+
+// A numeric result of a cell that is tracked across repeated runs and
+// compared against a baseline
+struct metric {
+    const char* name; // in the JSON file
+    const char* title;
+    unsigned precision;
+    bool higher_is_worse;
+    // Samples are only known to within this fraction of their value
+    double resolution;
+    std::function<double (const result&)> get;
+};
+
+// Width of a latency_histogram bucket, relative to its upper bound
+const double histogram_resolution = 0.125;
+
+const metric metrics[] = {
+    { "ctxsw_per_io", "ctxsw/io", 3, true, 0, [] (const result& r) { return r.ctxsw_per_io; } },
+    { "iops", "IOPS", 0, false, 0, [] (const result& r) { return r.iops; } },
+    { "bandwidth_mbs", "MB/s", 1, false, 0, [] (const result& r) { return r.bandwidth / 1e6; } },
+    { "latency_p50_usec", "latency p50 usec", 1, true, histogram_resolution,
+            [] (const result& r) { return r.completion_latency.percentile(0.5) / 1000.0; } },
+    { "latency_p99_usec", "latency p99 usec", 1, true, histogram_resolution,
+            [] (const result& r) { return r.completion_latency.percentile(0.99) / 1000.0; } },
+    { "latency_p999_usec", "latency p99.9 usec", 1, true, histogram_resolution,
+            [] (const result& r) { return r.completion_latency.percentile(0.999) / 1000.0; } },
+    { "submit_p999_usec", "submit p99.9 usec", 1, true, histogram_resolution,
+            [] (const result& r) { return r.submit_latency.percentile(0.999) / 1000.0; } },
+};
+
+const unsigned nr_metrics = sizeof(metrics) / sizeof(metrics[0]);
+
+// Two-sided 95% critical value of Student's t distribution
+double
+t_critical_95(double df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    // Round fractional (Welch) degrees of freedom down, which is conservative
+    auto n = unsigned(std::max(df, 1.0));
+    if (n <= 30) {
+        return table[n - 1];
+    }
+    return n <= 60 ? 2.000 : n <= 120 ? 1.980 : 1.960;
+}
+
+struct sample_stats {
+    unsigned n = 0;
+    double mean = 0;
+    double stddev = 0; // sample standard deviation
+    double ci95 = 0; // half width of the 95% confidence interval of the mean
+};
+
+sample_stats
+compute_stats(const std::vector<double>& samples) {
+    auto s = sample_stats();
+    s.n = samples.size();
+    if (!s.n) {
+        return s;
+    }
+    for (auto v : samples) {
+        s.mean += v / s.n;
+    }
+    if (s.n < 2) {
+        return s;
+    }
+    auto sum_sq = 0.0;
+    for (auto v : samples) {
+        sum_sq += (v - s.mean) * (v - s.mean);
+    }
+    s.stddev = std::sqrt(sum_sq / (s.n - 1));
+    s.ci95 = t_critical_95(s.n - 1) * s.stddev / std::sqrt(s.n);
+    return s;
+}
+
+// Welch's t-test: is the current mean worse than the baseline mean, with 95%
+// confidence? Both need at least two samples. Changes under 5% are ignored
+// even if significant, since with enough runs any difference would be.
+// Samples are quantized (to a histogram bucket, or to the precision shown),
+// so identical samples do not mean zero noise: a change of one quantum is
+// ignored, and the variance is floored at that of the quantization error.
+bool
+significantly_worse(const sample_stats& current, const sample_stats& baseline, const metric& m) {
+    auto worse = m.higher_is_worse ? current.mean > baseline.mean : current.mean < baseline.mean;
+    auto delta = std::abs(current.mean - baseline.mean);
+    auto quantum = std::max(m.resolution * std::max(std::abs(current.mean), std::abs(baseline.mean)),
+            std::pow(10.0, -int(m.precision)));
+    if (!worse || delta < 0.05 * std::abs(baseline.mean) || delta <= quantum) {
+        return false;
+    }
+    auto variance = [&] (const sample_stats& s) {
+        return std::max(s.stddev * s.stddev, quantum * quantum / 12) / s.n;
+    };
+    auto vc = variance(current);
+    auto vb = variance(baseline);
+    auto t = std::abs(current.mean - baseline.mean) / std::sqrt(vc + vb);
+    auto df = (vc + vb) * (vc + vb) / (vc * vc / (current.n - 1) + vb * vb / (baseline.n - 1));
+    return t > t_critical_95(df);
+}
+
+// One cell of the matrix across repeated runs. Cells that appear in the
+// matrix more than once are told apart by their occurrence number.
+struct cell_series {
+    cell_result cell;
+    std::string key;
+    std::array<std::vector<double>, nr_metrics> samples;
+};
+
+std::vector<cell_series>
+collect_series(const std::vector<std::vector<cell_result>>& runs) {
+    auto series = std::vector<cell_series>();
+    auto occurrences = std::map<std::string, unsigned>();
+    for (auto& c : runs.front()) {
+        auto key = std::to_string(c.iodepth) + " " + std::to_string(c.bufsize) + " " + to_string(c.op)
+                + (c.dsync ? " DSYNC " : " - ") + to_string(c.backend) + " " + to_string(c.completion);
+        key += " #" + std::to_string(occurrences[key]++);
+        series.push_back(cell_series{c, key, {}});
+    }
+    for (auto& run : runs) {
+        for (auto i = 0u; i < series.size() && i < run.size(); ++i) {
+            for (auto m = 0u; m < nr_metrics; ++m) {
+                series[i].samples[m].push_back(metrics[m].get(run[i].r));
+            }
+        }
+    }
+    return series;
+}
+
+std::string
+json_string(const std::string& s) {
+    auto ret = std::string("\"");
+    for (auto c : s) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+        }
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+bool
+write_json(const std::string& path, const std::vector<cell_series>& series, unsigned runs) {
+    std::ofstream f(path);
+    struct utsname u;
+    uname(&u);
+    f << std::setprecision(10);
+    f << "{\n";
+    f << "  \"kernel\": " << json_string(u.release) << ",\n";
+    f << "  \"runs\": " << runs << ",\n";
+    f << "  \"cells\": [";
+    for (auto i = 0u; i < series.size(); ++i) {
+        auto& s = series[i];
+        auto& c = s.cell;
+        f << (i ? "," : "") << "\n    {\n";
+        f << "      \"key\": " << json_string(s.key) << ",\n";
+        f << "      \"iodepth\": " << c.iodepth << ",\n";
+        f << "      \"bufsize\": " << c.bufsize << ",\n";
+        f << "      \"operation\": " << json_string(to_string(c.op)) << ",\n";
+        f << "      \"dsync\": " << (c.dsync ? "true" : "false") << ",\n";
+        f << "      \"backend\": " << json_string(to_string(c.backend)) << ",\n";
+        f << "      \"completion\": " << json_string(to_string(c.completion)) << ",\n";
+        f << "      \"metrics\": {";
+        for (auto m = 0u; m < nr_metrics; ++m) {
+            auto st = compute_stats(s.samples[m]);
+            f << (m ? "," : "") << "\n        " << json_string(metrics[m].name) << ": { ";
+            f << "\"mean\": " << st.mean << ", \"stddev\": " << st.stddev << ", \"ci95\": " << st.ci95;
+            f << ", \"samples\": [";
+            for (auto j = 0u; j < s.samples[m].size(); ++j) {
+                f << (j ? ", " : "") << s.samples[m][j];
+            }
+            f << "] }";
+        }
+        f << "\n      }\n    }";
+    }
+    f << "\n  ]\n}\n";
+    return bool(f);
+}
+
+// Just enough JSON to read back what write_json() writes
+struct json_value {
+    enum class type { null, boolean, number, string, array, object } t = type::null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> array;
+    std::map<std::string, json_value> object;
+};
+
+class json_parser {
+    const std::string& _s;
+    size_t _pos = 0;
+public:
+    explicit json_parser(const std::string& s) : _s(s) {}
+    json_value parse() {
+        auto v = value();
+        skip_space();
+        if (_pos != _s.size()) {
+            throw std::runtime_error("trailing garbage");
+        }
+        return v;
+    }
+private:
+    void skip_space() {
+        while (_pos < _s.size() && std::isspace(static_cast<unsigned char>(_s[_pos]))) {
+            ++_pos;
+        }
+    }
+    bool consume(char c) {
+        skip_space();
+        if (_pos < _s.size() && _s[_pos] == c) {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+    void expect(char c) {
+        if (!consume(c)) {
+            throw std::runtime_error(std::string("expected '") + c + "' at offset " + std::to_string(_pos));
+        }
+    }
+    bool keyword(const char* word) {
+        auto len = strlen(word);
+        if (_s.compare(_pos, len, word) == 0) {
+            _pos += len;
+            return true;
+        }
+        return false;
+    }
+    std::string string() {
+        expect('"');
+        auto ret = std::string();
+        while (_pos < _s.size() && _s[_pos] != '"') {
+            if (_s[_pos] == '\\') {
+                ++_pos;
+            }
+            if (_pos < _s.size()) {
+                ret += _s[_pos++];
+            }
+        }
+        expect('"');
+        return ret;
+    }
+    json_value value() {
+        auto v = json_value();
+        skip_space();
+        if (_pos == _s.size()) {
+            throw std::runtime_error("unexpected end of file");
+        }
+        if (_s[_pos] == '{') {
+            v.t = json_value::type::object;
+            expect('{');
+            if (!consume('}')) {
+                do {
+                    auto key = string();
+                    expect(':');
+                    v.object[key] = value();
+                } while (consume(','));
+                expect('}');
+            }
+        } else if (_s[_pos] == '[') {
+            v.t = json_value::type::array;
+            expect('[');
+            if (!consume(']')) {
+                do {
+                    v.array.push_back(value());
+                } while (consume(','));
+                expect(']');
+            }
+        } else if (_s[_pos] == '"') {
+            v.t = json_value::type::string;
+            v.string = string();
+        } else if (keyword("true")) {
+            v.t = json_value::type::boolean;
+            v.boolean = true;
+        } else if (keyword("false")) {
+            v.t = json_value::type::boolean;
+        } else if (keyword("null")) {
+            v.t = json_value::type::null;
+        } else {
+            v.t = json_value::type::number;
+            auto end = size_t(0);
+            v.number = std::stod(_s.substr(_pos, 32), &end);
+            _pos += end;
+        }
+        return v;
+    }
+};
+
+// Cell key -> metric samples, as written by write_json()
+using baseline_samples = std::map<std::string, std::map<std::string, std::vector<double>>>;
+
+bool
+load_baseline(const std::string& path, baseline_samples& baseline) {
+    std::ifstream f(path);
+    if (!f) {
+        std::cout << "cannot open baseline " << path << "\n";
+        return false;
+    }
+    std::stringstream contents;
+    contents << f.rdbuf();
+    try {
+        auto doc = json_parser(contents.str()).parse();
+        for (auto& cell : doc.object.at("cells").array) {
+            auto& samples = baseline[cell.object.at("key").string];
+            for (auto& m : cell.object.at("metrics").object) {
+                for (auto& v : m.second.object.at("samples").array) {
+                    samples[m.first].push_back(v.number);
+                }
+            }
+        }
+    } catch (std::exception& e) {
+        std::cout << "cannot parse baseline " << path << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Prints the mean, standard deviation and confidence interval of every
+// metric of every cell and, given a baseline, flags statistically
+// significant regressions. Returns the number of regressions.
+unsigned
+print_statistics(const std::vector<cell_series>& series, const baseline_samples* baseline) {
+    tabulate::Table stats;
+    auto headers = with_headers({"metric", "runs", "mean", "stddev", "95% CI"});
+    if (baseline) {
+        headers.insert(headers.end(), {"baseline mean", "change", "regression"});
+    }
+    stats.add_row(headers);
+    auto regressions = 0u;
+    for (auto& s : series) {
+        for (auto m = 0u; m < nr_metrics; ++m) {
+            auto st = compute_stats(s.samples[m]);
+            auto format = [&] (double v) {
+                std::ostringstream os;
+                os << std::fixed << std::setprecision(metrics[m].precision) << v;
+                return os.str();
+            };
+            auto row = cell_columns(s.cell);
+            row.insert(row.end(), {
+                metrics[m].title,
+                std::to_string(st.n),
+                format(st.mean),
+                st.n > 1 ? format(st.stddev) : "-",
+                st.n > 1 ? "±" + format(st.ci95) : "-",
+            });
+            if (baseline) {
+                auto cell = baseline->find(s.key);
+                auto samples = std::vector<double>();
+                if (cell != baseline->end() && cell->second.count(metrics[m].name)) {
+                    samples = cell->second.at(metrics[m].name);
+                }
+                if (samples.empty()) {
+                    row.insert(row.end(), {"-", "-", "not in baseline"});
+                } else {
+                    auto base = compute_stats(samples);
+                    std::ostringstream change;
+                    change << std::showpos << std::fixed << std::setprecision(1)
+                           << (base.mean ? (st.mean / base.mean - 1) * 100 : 0) << "%";
+                    auto verdict = std::string("-");
+                    if (st.n < 2 || base.n < 2) {
+                        verdict = "too few runs";
+                    } else if (significantly_worse(st, base, metrics[m])) {
+                        verdict = "REGRESSION";
+                        ++regressions;
+                    }
+                    row.insert(row.end(), {format(base.mean), base.mean ? change.str() : "-", verdict});
+                }
+            }
+            stats.add_row(row);
+        }
+    }
+    std::cout << "\n" << stats << "\n";
+    if (baseline) {
+        std::cout << "\n" << regressions << " statistically significant regressions\n";
+    }
+    return regressions;
+}
+
+// Fraction of the filesystem in use, as df reports it
+float
+filesystem_used(const char* path) {
+    struct statvfs s;
+    statvfs(path, &s);
+    auto used = float(s.f_blocks - s.f_bfree);
+    return used / (used + s.f_bavail);
+}
+
+uint64_t
+filesystem_available(const char* path) {
+    struct statvfs s;
+    statvfs(path, &s);
+    return uint64_t(s.f_bavail) * s.f_frsize;
+}
+
+struct aging_stats {
+    unsigned files_created = 0;
+    unsigned files_deleted = 0;
+    unsigned holes_punched = 0;
+    float used = 0;
+    float extents_per_file = 0;
+};
+
+// Ages the filesystem the way months of sstable writes and compactions do:
+// grows many files concurrently in random increments so their allocations
+// interleave, punches holes in some and deletes others, until target_used of
+// the filesystem is in use. churn is the percentage of written files that are
+// deleted again, and of those that get holes punched; more churn leaves free
+// space, and so later allocations, more fragmented. The files are left in dir.
+// A fixed random seed makes the resulting layout repeatable for a given
+// filesystem.
+aging_stats
+age_filesystem(const std::string& dir, float target_used, unsigned churn) {
+    // Leave room for the test files themselves
+    const uint64_t reserve = uint64_t(2) << 30;
+    const unsigned concurrent_files = 16;
+    auto stats = aging_stats();
+    mkdir(dir.c_str(), 0700);
+    std::default_random_engine random_engine(0);
+    auto random_size = [&] (unsigned min_shift, unsigned max_shift) {
+        auto shift = std::uniform_int_distribution<unsigned>(min_shift, max_shift)(random_engine);
+        return size_t(1) << shift;
+    };
+    auto chance = [&] (unsigned percent) {
+        return std::uniform_int_distribution<unsigned>(0, 99)(random_engine) < percent;
+    };
+    auto chunk = size_t(1) << 20;
+    auto buf = reinterpret_cast<char*>(aligned_alloc(4096, chunk));
+    std::generate_n(buf, chunk, [&] { return char(random_engine()); });
+    struct growing_file {
+        std::string name;
+        int fd;
+        size_t size;
+        size_t target;
+    };
+    auto growing = std::vector<growing_file>();
+    auto done = std::vector<std::string>();
+    auto next_file = 0u;
+    auto reported = 0u;
+    auto stop = false;
+    while (!stop && (stats.used = filesystem_used(dir.c_str())) < target_used
+            && filesystem_available(dir.c_str()) > reserve) {
+        if (unsigned(stats.used * 20) > reported) {
+            reported = stats.used * 20;
+            std::cout << "aging: " << unsigned(stats.used * 100) << "% used\n" << std::flush;
+        }
+        for (auto i = 0; i < 256; ++i) {
+            if (growing.size() < concurrent_files) {
+                auto name = dir + "/" + std::to_string(next_file++);
+                // O_DIRECT, so that blocks are allocated as we go rather than at writeback,
+                // interleaving the files' extents
+                auto fd = open(name.c_str(), O_CREAT|O_TRUNC|O_WRONLY|O_DIRECT, 0600);
+                if (fd == -1) {
+                    std::cout << "aging stopped: cannot create " << name << ": " << strerror(errno) << "\n";
+                    stop = true;
+                    break;
+                }
+                growing.push_back(growing_file{name, fd, 0, random_size(16, 26)}); // 64kB .. 64MB
+                ++stats.files_created;
+            }
+            auto j = std::uniform_int_distribution<size_t>(0, growing.size() - 1)(random_engine);
+            auto& f = growing[j];
+            auto len = std::min(random_size(12, 20), f.target - f.size); // 4kB .. 1MB
+            auto written = pwrite(f.fd, buf, len, f.size);
+            if (written != ssize_t(len)) {
+                // Running out of space just ends aging early
+                if (written == -1 && errno != ENOSPC) {
+                    std::cout << "aging stopped: cannot write " << f.name << ": " << strerror(errno) << "\n";
+                }
+                stop = true;
+                break;
+            }
+            f.size += len;
+            if (f.size < f.target) {
+                continue;
+            }
+            if (chance(churn)) {
+                // Punch a few holes, as partially rewritten and trimmed data does
+                for (auto k = 0; k < 4; ++k) {
+                    auto off = std::uniform_int_distribution<size_t>(0, f.size / 4096)(random_engine) * 4096;
+                    if (fallocate(f.fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, off, random_size(12, 18)) == 0) {
+                        ++stats.holes_punched;
+                    }
+                }
+            }
+            close(f.fd);
+            done.push_back(f.name);
+            growing.erase(growing.begin() + j);
+            if (chance(churn)) {
+                auto k = std::uniform_int_distribution<size_t>(0, done.size() - 1)(random_engine);
+                unlink(done[k].c_str());
+                done.erase(done.begin() + k);
+                ++stats.files_deleted;
+            }
+        }
+    }
+    stats.used = filesystem_used(dir.c_str());
+    for (auto& f : growing) {
+        close(f.fd);
+        done.push_back(f.name);
+    }
+    free(buf);
+    auto extents = uint64_t(0);
+    for (auto& name : done) {
+        auto fd = open(name.c_str(), O_RDONLY);
+        extents += count_extents(fd);
+        close(fd);
+    }
+    stats.extents_per_file = done.empty() ? 0 : float(extents) / done.size();
+    return stats;
+}
+
+// Removes dir and the files in it
+void remove_directory(const std::string& dir) {
+    auto d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    while (auto de = readdir(d)) {
+        if (de->d_name[0] != '.') {
+            unlink((dir + "/" + de->d_name).c_str());
+        }
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+void print_aging_comparison(const std::vector<cell_result>& fresh, const std::vector<cell_result>& aged) {
+    tabulate::Table results;
+    results.add_row(with_headers({"ctxsw/io fresh", "ctxsw/io aged", "IOPS fresh", "IOPS aged", "IOPS change",
+            "extents fresh", "extents aged", "verdict fresh", "verdict aged"}));
+    for (auto i = 0u; i < fresh.size() && i < aged.size(); ++i) {
+        auto& f = fresh[i].r;
+        auto& a = aged[i].r;
+        std::ostringstream change;
+        if (f.iops) {
+            change << std::showpos << std::fixed << std::setprecision(1) << (a.iops / f.iops - 1) * 100 << "%";
+        } else {
+            change << "-"; // no successful I/O in the fresh run, e.g. an ERROR cell
+        }
+        auto row = cell_columns(fresh[i]);
+        row.insert(row.end(), {
+            std::to_string(f.ctxsw_per_io),
+            std::to_string(a.ctxsw_per_io),
+            std::to_string(unsigned(f.iops)),
+            std::to_string(unsigned(a.iops)),
+            change.str(),
+            std::to_string(f.extents),
+            std::to_string(a.extents),
+            f.verdict,
+            a.verdict,
+        });
+        results.add_row(row);
+    }
+    std::cout << "\n" << results << "\n";
+}
+
+enum class metadata_op {
+    create,
+    fdatasync,
+    rename,
+    unlink,
+};
+
+std::string
+to_string(metadata_op op) {
+    switch (op) {
+    case metadata_op::create: return "create";
+    case metadata_op::fdatasync: return "fdatasync";
+    case metadata_op::rename: return "rename";
+    case metadata_op::unlink: return "unlink";
+    }
+    std::abort();
+}
+
+struct metadata_result {
+    latency_histogram latency;
+    unsigned calls = 0;
+    long ctxsw = 0;
+};
+
+// Issues op in bursts against files in dir, the way sstable creation and
+// deletion does, for duration seconds. Only the metadata calls themselves are
+// timed; what each needs (files to rename or unlink, dirty data to flush) is
+// prepared outside the timed section.
+metadata_result
+run_metadata_bursts(metadata_op op, const std::string& dir, unsigned duration, start_barrier& barrier) {
+    const unsigned burst_size = 50;
+    const auto pause = std::chrono::milliseconds(50);
+    auto ret = metadata_result();
+    mkdir(dir.c_str(), 0700);
+    auto name = [&] (unsigned i, bool renamed) {
+        return dir + "/" + std::to_string(i) + (renamed ? ".renamed" : "");
+    };
+    auto make_files = [&] {
+        for (auto i = 0u; i < burst_size; ++i) {
+            close(open(name(i, false).c_str(), O_CREAT|O_WRONLY, 0600));
+        }
+    };
+    auto data_fd = open((dir + "/data").c_str(), O_CREAT|O_TRUNC|O_WRONLY, 0600);
+    auto data = std::vector<char>(64 << 10, 'x');
+    auto renamed = false;
+    if (op == metadata_op::rename) {
+        make_files();
+    }
+    barrier.arrive_and_wait();
+    auto end = clock_type::now() + std::chrono::seconds(duration);
+    while (clock_type::now() < end) {
+        if (op == metadata_op::unlink) {
+            make_files();
+        }
+        for (auto i = 0u; i < burst_size; ++i) {
+            if (op == metadata_op::fdatasync) {
+                write(data_fd, data.data(), data.size());
+            }
+            auto start = clock_type::now();
+            auto r = with_ctxsw_counting(ret.ctxsw, [&] {
+                switch (op) {
+                case metadata_op::create: return open(name(i, false).c_str(), O_CREAT|O_EXCL|O_WRONLY, 0600);
+                case metadata_op::fdatasync: return fdatasync(data_fd);
+                case metadata_op::rename: return rename(name(i, renamed).c_str(), name(i, !renamed).c_str());
+                case metadata_op::unlink: return unlink(name(i, false).c_str());
+                }
+                std::abort();
+            });
+            ret.latency.add(to_ns(clock_type::now() - start));
+            ++ret.calls;
+            if (op == metadata_op::create && r >= 0) {
+                close(r);
+            }
+        }
+        if (op == metadata_op::create) {
+            for (auto i = 0u; i < burst_size; ++i) {
+                unlink(name(i, false).c_str());
+            }
+        }
+        renamed = !renamed;
+        std::this_thread::sleep_for(pause);
+    }
+    close(data_fd);
+    remove_directory(dir);
+    return ret;
+}
+
+// Runs a rate-limited append stream, as a memtable flush does, while another
+// thread performs bursts of each kind of metadata operation, to find
+// operations that block the thread issuing them or stall the AIO stream
+// behind them. The stream is first run alone for a baseline.
+void run_metadata_test(size_t bufsize, double write_rate, unsigned duration,
+        const std::vector<backend_type>& backends, const test_options& opts) {
+    auto cpus = allowed_cpus();
+    auto run_aio = [&] (backend_type backend, const std::atomic<bool>* stop, start_barrier& barrier) {
+        pin_to_cpu(cpus[0]);
+        auto fd = create_test_file("fsqual-meta-aio.tmp", operation::append, false, 0);
+        auto s = make_stream(fd, 3, bufsize, operation::append, backend);
+        // With a stop flag, leave room for the metadata phase to overrun
+        s.nr = std::max(1u, unsigned(write_rate * duration * (stop ? 2 : 1)));
+        s.rate = write_rate;
+        s.stop = stop;
+        barrier.arrive_and_wait();
+        auto r = run_io(s, opts);
+        close(fd);
+        return r;
+    };
+    tabulate::Table results;
+    results.add_row({"operation", "backend", "calls", "usec p50/p90/p99/p99.9/max", "ctxsw/call",
+            "AIO ctxsw/io", "AIO latency usec p50/p90/p99/p99.9/max", "AIO p99.9 vs baseline", "verdict"});
+    for (auto backend : backends) {
+        start_barrier alone(1);
+        auto baseline = run_on_thread([&] { return run_aio(backend, nullptr, alone); });
+        results.add_row({"(none)", to_string(backend), "-", "-", "-",
+                std::to_string(baseline.ctxsw_per_io), format_percentiles(baseline.completion_latency),
+                "-", baseline.verdict});
+        for (auto op : {metadata_op::create, metadata_op::fdatasync, metadata_op::rename, metadata_op::unlink}) {
+            std::atomic<bool> stop(false);
+            start_barrier both(2);
+            auto aio = result();
+            auto writer = std::thread([&] { aio = run_aio(backend, &stop, both); });
+            auto meta = run_on_thread([&] {
+                pin_to_cpu(cpus[1 % cpus.size()]);
+                auto r = run_metadata_bursts(op, "fsqual-meta", duration, both);
+                stop = true;
+                return r;
+            });
+            writer.join();
+            auto ratio = double(aio.completion_latency.percentile(0.999))
+                    / std::max<uint64_t>(baseline.completion_latency.percentile(0.999), 1);
+            auto ctxsw_per_call = double(meta.ctxsw) / std::max(meta.calls, 1u);
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(2) << "x" << ratio;
+            auto verdict = "GOOD";
+            if (ratio > 2 || aio.ctxsw_per_io - baseline.ctxsw_per_io >= opts.limits.ctxsw_per_io) {
+                verdict = "BAD (stalls AIO)";
+            } else if (op != metadata_op::fdatasync && ctxsw_per_call >= opts.limits.ctxsw_per_io) {
+                // fdatasync waits for I/O by design; other calls should not
+                verdict = "BAD (blocks)";
+            }
+            results.add_row({
+                to_string(op),
+                to_string(backend),
+                std::to_string(meta.calls),
+                format_percentiles(meta.latency),
+                std::to_string(ctxsw_per_call),
+                std::to_string(aio.ctxsw_per_io),
+                format_percentiles(aio.completion_latency),
+                os.str(),
+                verdict,
+            });
+        }
+    }
+    std::cout << results << "\n";
+}
+
+void usage(const char* prog) {
+    std::cout << "usage: " << prog << " [options]\n"
+              << "  --backend NAME    run the matrix under NAME (libaio, io_uring, io_uring+sqpoll,\n"
+              << "                    io_uring+fixed); may be repeated, default is all supported\n"
+              << "  --completion MODE harvest completions by MODE (poll, block, eventfd, ring); may be\n"
+              << "                    repeated, default is poll\n"
+              << "  --max-submit-p999 USEC\n"
+              << "                    fail cells whose p99.9 submit time exceeds USEC\n"
+              << "  --max-latency-p999 USEC\n"
+              << "                    fail cells whose p99.9 submit-to-completion latency exceeds USEC\n"
+              << "  --sweep           instead of the matrix, sweep iodepth (1..1024) and request size\n"
+              << "                    (sector..1MB) and report the blocking boundary and throughput knee\n"
+              << "  --shards[=N]      instead of the matrix, run 1, 2, 4, ... N (default: all cpus) pinned\n"
+              << "                    threads concurrently, each with its own I/O context and file\n"
+              << "  --shared-file     with --shards, have all threads write to a single file\n"
+              << "  --prealloc        instead of the matrix, compare preallocation strategies (ftruncate,\n"
+              << "                    fallocate variants, extent size hints) for append and fill\n"
+              << "  --interference    instead of the matrix, measure how a DSYNC append stream and a random\n"
+              << "                    read stream interfere when running concurrently\n"
+              << "  --metadata        instead of the matrix, perform bursts of create, fdatasync, rename and\n"
+              << "                    unlink during an append stream and report calls that block or stall it\n"
+              << "  --write-rate IOPS with --interference or --metadata, the append rate (default 1000)\n"
+              << "  --read-rate IOPS  with --interference, the read rate (default 5000)\n"
+              << "  --duration SEC    with --interference or --metadata, the length of each run (default 5)\n"
+              << "  --age[=PERCENT]   after the matrix, age the filesystem until PERCENT (default 80) of it\n"
+              << "                    is used, run the matrix again, and compare\n"
+              << "  --age-churn PERCENT\n"
+              << "                    with --age, the percentage of aging files deleted again and of those\n"
+              << "                    with holes punched (default 30, at most 90); more fragments free space\n"
+              << "  --repeat K        run the matrix K times and report the mean, standard deviation and 95%\n"
+              << "                    confidence interval of each cell's ctxsw/io, throughput and latency\n"
+              << "  --json FILE       write the per-cell statistics and samples to FILE\n"
+              << "  --baseline FILE   compare against a file written by --json, flag statistically significant\n"
+              << "                    regressions, and exit with status 2 if there are any\n"
+              << "  --stacks          record the kernel call paths at which submission blocked, and\n"
+              << "                    report the most frequent ones for each cell of the matrix\n";
+}
+
+int main(int ac, char** av) {
+    auto backends = std::vector<backend_type>();
+    auto completions = std::vector<completion_mode>();
+    auto opts = test_options();
+    auto sweep = false;
+    auto shards = false;
+    auto max_shards = 0u;
+    auto shared_file = false;
+    auto prealloc = false;
+    auto interference = false;
+    auto metadata = false;
+    auto write_rate = 1000.0;
+    auto read_rate = 5000.0;
+    auto duration = 5u;
+    auto age_target = 0.0f;
+    auto age_churn = 30u;
+    auto repeat = 1u;
+    auto json_file = std::string();
+    auto baseline_file = std::string();
+    static const option long_options[] = {
+        { "backend", required_argument, nullptr, 'b' },
+        { "completion", required_argument, nullptr, 'c' },
+        { "max-submit-p999", required_argument, nullptr, 's' },
+        { "max-latency-p999", required_argument, nullptr, 'l' },
+        { "sweep", no_argument, nullptr, 'S' },
+        { "shards", optional_argument, nullptr, 'n' },
+        { "shared-file", no_argument, nullptr, 'F' },
+        { "stacks", no_argument, nullptr, 'k' },
+        { "prealloc", no_argument, nullptr, 'p' },
+        { "interference", no_argument, nullptr, 'i' },
+        { "metadata", no_argument, nullptr, 'm' },
+        { "write-rate", required_argument, nullptr, 'w' },
+        { "read-rate", required_argument, nullptr, 'r' },
+        { "duration", required_argument, nullptr, 'd' },
+        { "age", optional_argument, nullptr, 'a' },
+        { "age-churn", required_argument, nullptr, 'u' },
+        { "repeat", required_argument, nullptr, 'R' },
+        { "json", required_argument, nullptr, 'j' },
+        { "baseline", required_argument, nullptr, 'B' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(ac, av, "h", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'b': {
+            auto b = std::find_if(std::begin(all_backends), std::end(all_backends), [] (backend_type b) {
+                return to_string(b) == optarg;
+            });
+            if (b == std::end(all_backends)) {
+                std::cout << "unknown backend: " << optarg << "\n";
+                return 1;
+            }
+            backends.push_back(*b);
+            break;
+        }
+        case 'c': {
+            auto m = std::find_if(std::begin(all_completion_modes), std::end(all_completion_modes), [] (completion_mode m) {
+                return to_string(m) == optarg;
+            });
+            if (m == std::end(all_completion_modes)) {
+                std::cout << "unknown completion mode: " << optarg << "\n";
+                return 1;
+            }
+            completions.push_back(*m);
+            break;
+        }
+        case 's':
+            opts.limits.submit_p999_ns = std::stoull(optarg) * 1000;
+            break;
+        case 'l':
+            opts.limits.latency_p999_ns = std::stoull(optarg) * 1000;
+            break;
+        case 'S':
+            sweep = true;
+            break;
+        case 'n':
+            shards = true;
+            max_shards = optarg ? std::stoul(optarg) : 0;
+            break;
+        case 'F':
+            shared_file = true;
+            break;
+        case 'k':
+            opts.collect_stacks = true;
+            break;
+        case 'p':
+            prealloc = true;
+            break;
+        case 'i':
+            interference = true;
+            break;
+        case 'm':
+            metadata = true;
+            break;
+        case 'w':
+            write_rate = std::stod(optarg);
+            break;
+        case 'r':
+            read_rate = std::stod(optarg);
+            break;
+        case 'd':
+            duration = std::stoul(optarg);
+            break;
+        case 'a':
+            age_target = optarg ? std::stof(optarg) : 80;
+            break;
+        case 'u':
+            age_churn = std::min(90ul, std::stoul(optarg));
+            break;
+        case 'R':
+            repeat = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'B':
+            baseline_file = optarg;
+            break;
+        case 'h':
+            usage(av[0]);
+            return 0;
+        default:
+            usage(av[0]);
+            return 1;
+        }
+    }
+    if (opts.collect_stacks && (sweep || shards || prealloc || interference || metadata)) {
+        // Only the matrix reports blocking paths
+        std::cout << "--stacks cannot be combined with --sweep, --shards, --prealloc, --interference or --metadata\n";
+        return 1;
+    }
+    auto baseline = baseline_samples();
+    if (!baseline_file.empty() && !load_baseline(baseline_file, baseline)) {
+        return 1;
+    }
+    auto info = get_dio_info();
+    auto bsize = get_blocksize();
+    std::cout << "memory DMA alignment:    " << info.memory_alignment << "\n";
+    std::cout << "disk DMA alignment:      " << info.disk_alignment << "\n";
+    std::cout << "filesystem block size:   " << bsize << "\n";
+
+    if (completions.empty()) {
+        completions.push_back(completion_mode::poll);
+    }
+    if (backends.empty()) {
+        backends.assign(std::begin(all_backends), std::end(all_backends));
+    }
+    backends.erase(std::remove_if(backends.begin(), backends.end(), [&] (backend_type b) {
+        auto ok = backend_supported(b);
+        if (!ok) {
+            std::cout << "backend " << to_string(b) << " not supported, skipping\n";
+        }
+        return !ok;
+    }), backends.end());
+    if (backends.empty()) {
+        return 1;
+    }
+    if (opts.collect_stacks && !make_stack_profiler()) {
+        std::cout << "neither perf_event_open with readable /proc/kallsyms nor /proc/self/task/<tid>/stack are usable,"
+                  << " not collecting stacks\n";
+        opts.collect_stacks = false;
+    }
+
+    if (sweep) {
+        run_sweep(info.disk_alignment, backends, opts);
+        return 0;
+    }
+    if (shards) {
+        run_scaling(max_shards, shared_file, bsize, backends, opts);
+        return 0;
+    }
+    if (prealloc) {
+        run_prealloc_matrix(bsize, backends, opts);
+        return 0;
+    }
+    if (interference) {
+        run_interference(bsize, write_rate, read_rate, duration, backends, opts);
+        return 0;
+    }
+    if (metadata) {
+        run_metadata_test(bsize, write_rate, duration, backends, opts);
+        return 0;
+    }
+
+    auto variants = std::vector<test_variant>();
+    for (auto backend : backends) {
+        for (auto completion : completions) {
+            if (backend_supported(backend, completion)) {
+                variants.emplace_back(backend, completion);
+            }
+        }
+    }
+
+    run_nowait_test(bsize);
+
+    auto runs = std::vector<std::vector<cell_result>>();
+    for (auto i = 0u; i < repeat; ++i) {
+        if (repeat > 1) {
+            std::cout << "\nrun " << i + 1 << "/" << repeat << "\n";
+        }
+        runs.push_back(run_matrix(info, bsize, variants, opts));
+        print_matrix(runs.back(), opts);
+    }
+    auto& cells = runs.front();
+    auto regressions = 0u;
+    if (repeat > 1 || !json_file.empty() || !baseline_file.empty()) {
+        auto series = collect_series(runs);
+        regressions = print_statistics(series, baseline_file.empty() ? nullptr : &baseline);
+        if (!json_file.empty() && !write_json(json_file, series, repeat)) {
+            std::cout << "failed to write " << json_file << "\n";
+            return 1;
+        }
+    }
+
+    if (age_target) {
+        auto aging_dir = "fsqual-aging";
+        auto stats = age_filesystem(aging_dir, age_target / 100, age_churn);
+        tabulate::Table aging;
+        aging.add_row({"files created", "files deleted", "holes punched", "filesystem used", "extents/file"});
+        aging.add_row({
+            std::to_string(stats.files_created),
+            std::to_string(stats.files_deleted),
+            std::to_string(stats.holes_punched),
+            std::to_string(unsigned(stats.used * 100)) + "%",
+            std::to_string(stats.extents_per_file),
+        });
+        std::cout << "\n" << aging << "\n";
+        auto aged = run_matrix(info, bsize, variants, opts);
+        remove_directory(aging_dir);
+        print_aging_comparison(cells, aged);
+    }
 
-    return 0;
+    return regressions ? 2 : 0;
 }